@@ -56,6 +56,9 @@ public class Player : MonoBehaviour
 
         levelManager = FindFirstObjectByType<LevelManager>();
         levelManager?.SpawnElements();
+
+        // Start feeding the story prompt to the LLM while the life is being played
+        FindFirstObjectByType<StoryManager>()?.BeginLife();
     }
 
     private void GridObject_onTurnTo(Vector2Int sourcePos, Vector2Int destPos)
@@ -213,11 +216,14 @@ public class Player : MonoBehaviour
         }
         else
         {
-            lifeEvents.Add(new LifeEvent(LifeEvent.Type.Action, _age)
+            var lifeEvent = new LifeEvent(LifeEvent.Type.Action, _age)
             {
                 action = action,
                 iconDef = iconDef
-            });
+            };
+            lifeEvents.Add(lifeEvent);
+
+            FindFirstObjectByType<StoryManager>()?.AddLifeEvent(lifeEvent);
         }
 
         deathProbability += action.deltaDanger;
@@ -30,7 +30,73 @@ public class StoryLLM
     private static extern int llm_set_sampler_greedy(int queryId);
     
     [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
-    private static extern int llm_get_answer(int queryId, StringBuilder buffer, int bufferSize, out int generatedTokens, out int maxTokens);
+    private static extern int llm_set_retain(int queryId, int ttlMs);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern void llm_set_retain_limit(int maxContexts);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_continue(int queryId, string extraPrompt, int maxTokens);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_set_speculation(int queryId, bool enable, int ngramSize, int maxDraft);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_get_speculation_stats(int queryId, out int drafted, out int accepted);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_load_adapter(string path);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_unload_adapter(int adapterId);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_set_adapter(int queryId, int adapterId, float scale);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_set_seed(int queryId, uint seed);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern void llm_cache_enable(bool enable);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_cache_open(string path);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern void llm_cache_clear();
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_session_begin_ex(string prefix, int adapterId, float adapterScale);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_session_append(int sessionId, string text);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_session_generate(int sessionId, string suffix, int maxTokens);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_session_end(int sessionId);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_set_deadline(int queryId, int msFirstToken, int msTotal);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_set_deadline_degrade(int queryId, int degradeFlags);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern void llm_get_throughput(out float decodeTps, out float prefillTps);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_get_answer(int queryId, byte[] buffer, int bufferSize, out int generatedTokens, out int maxTokens);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_get_answer_ex(int queryId, byte[] buffer, int bufferSize, out int generatedTokens, out int maxTokens, out int flags);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern int llm_connect_host(string pipeName, string hostPath);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    private static extern void llm_disconnect_host();
 
     public const int STATUS_QUEUED = 0;
     public const int STATUS_RUNNING = 1;
@@ -39,6 +105,19 @@ public class StoryLLM
     public const int STATUS_INVALID = 4;
     public const int STATUS_INTERRUPTED = 5;
 
+    public const int FLAG_DEADLINE = 1;
+    public const int FLAG_DEGRADED = 2;
+    public const int FLAG_CACHED = 4;
+
+    [System.Flags]
+    public enum DeadlineDegrade
+    {
+        None = 0,
+        Greedy = 1,
+        Shrink = 2,
+        Steer = 4
+    }
+
     public enum LLMInitStatus
     {
         Ok = 0,
@@ -79,6 +158,109 @@ public class StoryLLM
         llm_set_sampler_greedy(queryId);
     }
 
+    // Sessions receive the prompt in pieces and prefill it in the background, the returned id
+    // works like a query id once SessionGenerate is called
+    public static int SessionBegin(string prefix, int adapterId = 0, float adapterScale = 1.0f)
+    {
+        return llm_session_begin_ex(prefix, adapterId, adapterScale);
+    }
+
+    public static int SessionAppend(int sessionId, string text)
+    {
+        return llm_session_append(sessionId, text);
+    }
+
+    public static int SessionGenerate(int sessionId, string suffix, int maxTokens = 512)
+    {
+        return llm_session_generate(sessionId, suffix, maxTokens);
+    }
+
+    public static void SessionEnd(int sessionId)
+    {
+        llm_session_end(sessionId);
+    }
+
+    // Keeps the query's state for ttlMs after it finishes, so Continue only has to process the new text
+    public static void SetRetain(int queryId, int ttlMs)
+    {
+        llm_set_retain(queryId, ttlMs);
+    }
+
+    public static void SetRetainLimit(int maxContexts)
+    {
+        llm_set_retain_limit(maxContexts);
+    }
+
+    // Returns the id to Start and poll (-1 if the query wasn't retained or expired)
+    public static int Continue(int queryId, string extraPrompt, int maxTokens = 256)
+    {
+        return llm_continue(queryId, extraPrompt, maxTokens);
+    }
+
+    // Prompt lookup speculation: guesses the next tokens from text that already appeared in the
+    // prompt or answer (names, events, tags) and checks them all in one go
+    public static void SetSpeculation(int queryId, bool enable, int ngramSize = 3, int maxDraft = 8)
+    {
+        llm_set_speculation(queryId, enable, ngramSize, maxDraft);
+    }
+
+    // Can be called after GetAnswer returns the final status, to get the final counts
+    public static (int drafted, int accepted) GetSpeculationStats(int queryId)
+    {
+        llm_get_speculation_stats(queryId, out int drafted, out int accepted);
+        return (drafted, accepted);
+    }
+
+    // LoRA adapters are loaded once on top of the current model and can then be picked per query
+    public static int LoadAdapter(string path)
+    {
+        return llm_load_adapter(path);
+    }
+
+    public static bool UnloadAdapter(int adapterId)
+    {
+        return llm_unload_adapter(adapterId) == (int)LLMInitStatus.Ok;
+    }
+
+    public static void SetAdapter(int queryId, int adapterId, float scale = 1.0f)
+    {
+        llm_set_adapter(queryId, adapterId, scale);
+    }
+
+    public static void SetSeed(int queryId, uint seed)
+    {
+        llm_set_seed(queryId, seed);
+    }
+
+    // Answers of greedy or seeded queries are cached, so repeating them doesn't run the model again
+    public static void EnableCache(bool enable)
+    {
+        llm_cache_enable(enable);
+    }
+
+    public static bool OpenCache(string path)
+    {
+        return llm_cache_open(path) == (int)LLMInitStatus.Ok;
+    }
+
+    public static void ClearCache()
+    {
+        llm_cache_clear();
+    }
+
+    // Time limits in ms (0 = no limit), the task finishes with FLAG_DEADLINE when they expire
+    public static void SetDeadline(int queryId, int msFirstToken, int msTotal, DeadlineDegrade degrade = DeadlineDegrade.None)
+    {
+        llm_set_deadline(queryId, msFirstToken, msTotal);
+        llm_set_deadline_degrade(queryId, (int)degrade);
+    }
+
+    public static (float decode, float prefill) GetThroughput()
+    {
+        llm_get_throughput(out float decode, out float prefill);
+        return (decode, prefill);
+    }
+
     public static void Start(int id)
     {
         llm_start(id);
@@ -91,10 +273,45 @@ public class StoryLLM
 
     public static (int status, string text, int generated, int max) GetAnswer(int id)
     {
-        var sb = new StringBuilder(8000);
+        var buffer = new byte[8000];
         int gen, max;
-        int status = llm_get_answer(id, sb, sb.Capacity, out gen, out max);
-        return (status, sb.ToString(), gen, max);
+        int status = llm_get_answer(id, buffer, buffer.Length, out gen, out max);
+        return (status, DecodeAnswer(buffer), gen, max);
+    }
+
+    public static (int status, string text, int generated, int max, int flags) GetAnswerEx(int id)
+    {
+        var buffer = new byte[8000];
+        int gen, max, flags;
+        int status = llm_get_answer_ex(id, buffer, buffer.Length, out gen, out max, out flags);
+        return (status, DecodeAnswer(buffer), gen, max, flags);
+    }
+
+    // The answer is UTF-8 (the DLL only hands out complete characters), zero terminated
+    static string DecodeAnswer(byte[] buffer)
+    {
+        int len = System.Array.IndexOf(buffer, (byte)0);
+        if (len < 0) len = buffer.Length;
+        return Encoding.UTF8.GetString(buffer, 0, len);
+    }
+
+    // Runs the model in a separate process (llm_host), started from hostPath if it isn't running yet,
+    // so it stays loaded between runs. Call before Initialize.
+    public static bool ConnectHost(string hostPath, string pipeName = "")
+    {
+        try
+        {
+            return llm_connect_host(pipeName, hostPath) == 0;
+        }
+        catch
+        {
+            return false;
+        }
+    }
+
+    public static void DisconnectHost()
+    {
+        llm_disconnect_host();
     }
 
     public static void Shutdown()
@@ -27,6 +27,8 @@ public class StoryManager : MonoBehaviour
     [SerializeField] bool enableRepetionPenalty = false;
     [SerializeField, ShowIf(nameof(enableRepetionPenalty))] float repetionPenalty = 1.1f;
     [SerializeField, ShowIf(nameof(enableRepetionPenalty))] int repetitionWindow = 64;
+    [SerializeField] bool useSpeculation = true;
+    [SerializeField] bool useHostProcess = false;
 
     [Header("UI")]
     [SerializeField] Hypertag storyContainerTag;
@@ -42,6 +44,9 @@ public class StoryManager : MonoBehaviour
 
     int         queryId = -1;
     string      lastPrompt;
+    int         sessionId = -1;
+    string      sessionPrefix;
+    int         sessionEvents = 0;
     string      currentModel = "";
 
     public string modelName => currentModel;
@@ -107,6 +112,7 @@ public class StoryManager : MonoBehaviour
         {
             StoryLLM.Shutdown();
             currentModel = "";
+            sessionId = -1;
         }
 
         modelName = CheckModel(modelName);
@@ -115,6 +121,16 @@ public class StoryManager : MonoBehaviour
         var extension = Path.GetExtension(modelPath);
         if (extension.ToLower() != ".gguf") modelPath += ".gguf";
 
+        if (useHostProcess)
+        {
+            // Model lives in llm_host, so it doesn't need to be loaded again every time we hit play
+            string hostPath = Path.Combine(Application.streamingAssetsPath, "llm_host.exe");
+            if (!StoryLLM.ConnectHost(hostPath))
+            {
+                Debug.LogWarning("Couldn't connect to the LLM host, running in process.");
+            }
+        }
+
         var status = StoryLLM.Initialize(modelPath, gpuLayers, contextSize);
 
         switch (status)
@@ -258,14 +274,70 @@ public class StoryManager : MonoBehaviour
     {
         if (currentModel != "")
         {
+            EndSession();
             StoryLLM.Shutdown();
         }
     }
 
+    // Opens a LLM session with the start of the prompt, so that the events can be prefilled
+    // while the game is running, instead of all at once when the player dies
+    public void BeginLife()
+    {
+        EndSession();
+
+        if (currentModel == "") return;
+
+        sessionPrefix = BuildPromptPrefix();
+        sessionId = StoryLLM.SessionBegin(sessionPrefix);
+        sessionEvents = 0;
+    }
+
+    public void AddLifeEvent(LifeEvent evt)
+    {
+        if (sessionId == -1) return;
+
+        StoryLLM.SessionAppend(sessionId, evt.GetString() + "\n");
+        sessionEvents++;
+    }
+
+    void EndSession()
+    {
+        if (sessionId == -1) return;
+
+        StoryLLM.SessionEnd(sessionId);
+        sessionId = -1;
+    }
+
     public void StartStory(List<LifeEvent> events)
     {
         if (queryId != -1) return;
 
+        string prefix = BuildPromptPrefix();
+        string suffix = BuildPromptSuffix();
+
+        lastPrompt = prefix + BuildEventsText(events, 0) + suffix;
+
+        Debug.Log($"Prompt=[{lastPrompt}]");
+
+        if ((sessionId != -1) && (sessionPrefix == prefix) && (sessionEvents <= events.Count))
+        {
+            // Most of the prompt is already processed, only the remaining events and the rules are missing
+            queryId = sessionId;
+            sessionId = -1;
+
+            StoryLLM.SessionAppend(queryId, BuildEventsText(events, sessionEvents));
+            ConfigureQuery(queryId);
+            StoryLLM.SessionGenerate(queryId, suffix, 512);
+        }
+        else
+        {
+            EndSession();
+            RetryStory();
+        }
+    }
+
+    string BuildPromptPrefix()
+    {
         var genre = PlayerPrefs.GetString("LLMGenre", "Realistic");
         var pov = PlayerPrefs.GetString("LLMPOV", "3rd Person");
         var mood = PlayerPrefs.GetString("LLMMood", "Hopeful");
@@ -273,21 +345,42 @@ public class StoryManager : MonoBehaviour
         switch (promptType)
         {
             case PromptType.Normal:
-                lastPrompt = BuildNormalPrompt(genre, pov, mood, events);
-                break;
+                return BuildNormalPromptPrefix(genre, pov, mood);
             case PromptType.ShortAndDirect:
-                lastPrompt = BuildShortAndDirectPrompt(genre, pov, mood, events);
+                return BuildShortAndDirectPromptPrefix(genre, pov, mood);
+            default:
                 break;
+        }
+
+        return "";
+    }
+
+    string BuildPromptSuffix()
+    {
+        switch (promptType)
+        {
+            case PromptType.Normal:
+                return BuildNormalPromptSuffix();
+            case PromptType.ShortAndDirect:
+                return BuildShortAndDirectPromptSuffix();
             default:
                 break;
         }
 
-        Debug.Log($"Prompt=[{lastPrompt}]");
+        return "";
+    }
 
-        RetryStory();
+    string BuildEventsText(List<LifeEvent> events, int startIndex)
+    {
+        string ret = "";
+        for (int i = startIndex; i < events.Count; i++)
+        {
+            ret += events[i].GetString() + "\n";
+        }
+        return ret;
     }
 
-    private string BuildNormalPrompt(string genre, string pov, string mood, List<LifeEvent> events)
+    private string BuildNormalPromptPrefix(string genre, string pov, string mood)
     {
         string systemPrompt = @"
             You are a micro-fiction generator.
@@ -313,17 +406,16 @@ public class StoryManager : MonoBehaviour
         ";
 
         string storyPrompt = $"Write a {mood} {genre} short story based on these life events:\n";
-        foreach (var evt in events)
-        {
-            storyPrompt += evt.GetString() + "\n";
-        }
 
-        string additionalRules = "IMPORTANT: The character MUST die in the story, exactly as described by the last event.\n";
+        return systemPrompt + storyPrompt;
+    }
 
-        return systemPrompt + storyPrompt + additionalRules;
+    private string BuildNormalPromptSuffix()
+    {
+        return "IMPORTANT: The character MUST die in the story, exactly as described by the last event.\n";
     }
 
-    private string BuildShortAndDirectPrompt(string genre, string pov, string mood, List<LifeEvent> events)
+    private string BuildShortAndDirectPromptPrefix(string genre, string pov, string mood)
     {
         string systemPrompt = @"
             You will write a short story.
@@ -339,27 +431,34 @@ public class StoryManager : MonoBehaviour
         systemPrompt += $"- {pov}\n";
 
             string storyPrompt = $"Write a {mood} {genre} story inspired by:\n";
-        foreach (var evt in events)
-        {
-            storyPrompt += evt.GetString() + "\n";
-        }
 
+        return systemPrompt + storyPrompt;
+    }
+
+    private string BuildShortAndDirectPromptSuffix()
+    {
         string additionalRules = @"Remember: The character MUST die exactly as described.
 
         Now begin. Output only:
 
         <story>";
 
-        return systemPrompt + storyPrompt + additionalRules;
+        return additionalRules;
     }
 
-    void RetryStory()
+    void ConfigureQuery(int id)
     {
         temperature = PlayerPrefs.GetFloat("LLMTemperature", temperature);
 
+        StoryLLM.SetTerminationToken(id, "</story>");
+        StoryLLM.UseImprovedSampler(id, temperature, topP, enableRepetionPenalty, repetionPenalty, repetitionWindow);
+        StoryLLM.SetSpeculation(id, useSpeculation);
+    }
+
+    void RetryStory()
+    {
         queryId = StoryLLM.Query(lastPrompt, 512);
-        StoryLLM.SetTerminationToken(queryId, "</story>");
-        StoryLLM.UseImprovedSampler(queryId, temperature, topP, enableRepetionPenalty, repetionPenalty, repetitionWindow);
+        ConfigureQuery(queryId);
 
         StoryLLM.Start(queryId);
     }
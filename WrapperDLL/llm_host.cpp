@@ -0,0 +1,648 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include "llm_ipc.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// llm_host: owns the model and the tasks on behalf of llm_wrapper running in client mode
+// (llm_connect_host), so the model stays loaded across game/editor restarts and can be shared by
+// several processes. Runs the same llm_wrapper code, in process.
+//
+// Usage: llm_host [--pipe name] [--model path] [--gpu-layers n] [--context n] [--idle-timeout seconds]
+//
+// Exits (freeing the model) after idle-timeout seconds without clients, 0 keeps it running.
+
+extern "C" {
+__declspec(dllimport) int  llm_init(const char * model_path, int gpu_layers, int context_size);
+__declspec(dllimport) int  llm_load_adapter(const char * path);
+__declspec(dllimport) int  llm_unload_adapter(int adapter_id);
+__declspec(dllimport) int  llm_query(const char * prompt, int maxTokens);
+__declspec(dllimport) int  llm_set_termination_token(int query_id, const char * terminator);
+__declspec(dllimport) int  llm_set_sampler_improved(int query_id, float temperature, float top_p, bool enableRepetionPenalty, float repetionPenalty, int repetitionWindow);
+__declspec(dllimport) int  llm_set_sampler_greedy(int query_id);
+__declspec(dllimport) int  llm_set_seed(int query_id, unsigned int seed);
+__declspec(dllimport) int  llm_set_deadline(int query_id, int ms_first_token, int ms_total);
+__declspec(dllimport) int  llm_set_deadline_degrade(int query_id, int degrade_flags);
+__declspec(dllimport) void llm_get_throughput(float * out_decode_tps, float * out_prefill_tps);
+__declspec(dllimport) int  llm_set_retain(int query_id, int ttl_ms);
+__declspec(dllimport) void llm_set_retain_limit(int max_contexts);
+__declspec(dllimport) int  llm_continue(int query_id, const char * extra_prompt, int max_tokens);
+__declspec(dllimport) int  llm_set_speculation(int query_id, bool enable, int ngram_size, int max_draft);
+__declspec(dllimport) int  llm_get_speculation_stats(int query_id, int * out_drafted, int * out_accepted);
+__declspec(dllimport) int  llm_set_adapter(int query_id, int adapter_id, float scale);
+__declspec(dllimport) int  llm_start(int query_id);
+__declspec(dllimport) int  llm_stop(int query_id);
+__declspec(dllimport) int  llm_get_answer_ex(int query_id, char * buffer, int buffer_size, int * out_generated_tokens, int * out_max_tokens, int * out_flags);
+__declspec(dllimport) int  llm_get_answer_from(int query_id, int offset, char * buffer, int buffer_size, int * out_offset, int * out_length,
+                                               int * out_generated_tokens, int * out_max_tokens, int * out_flags);
+__declspec(dllimport) int  llm_session_begin_ex(const char * prefix, int adapter_id, float adapter_scale);
+__declspec(dllimport) int  llm_session_append(int session_id, const char * text);
+__declspec(dllimport) int  llm_session_generate(int session_id, const char * suffix, int max_tokens);
+__declspec(dllimport) int  llm_session_end(int session_id);
+__declspec(dllimport) void llm_cache_enable(bool enable);
+__declspec(dllimport) int  llm_cache_open(const char * path);
+__declspec(dllimport) void llm_cache_clear();
+__declspec(dllimport) void llm_shutdown();
+}
+
+static void Log(const char * fmt, ...)
+{
+    static std::mutex logMutex;
+
+    std::lock_guard<std::mutex> lock(logMutex);
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stdout, fmt, args);
+    va_end(args);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// MODEL
+// Shared by all connections; a client can only switch to another model if it's the only one connected
+
+using HostClock = std::chrono::steady_clock;
+
+static std::mutex            g_hostMutex;
+static std::string           g_modelPath;
+static int                   g_connections = 0;
+static HostClock::time_point g_idleSince   = HostClock::now();  // when the last client left
+
+static int host_init(const std::string & model_path, int gpu_layers, int context_size)
+{
+    std::lock_guard<std::mutex> lock(g_hostMutex);
+
+    if ((!g_modelPath.empty()) && (g_modelPath != model_path))
+    {
+        if (g_connections > 1)
+        {
+            Log("Can't load %s, other clients are using %s!", model_path.c_str(), g_modelPath.c_str());
+            return LLM_INIT_ERROR;
+        }
+
+        Log("Switching model to %s...", model_path.c_str());
+
+        llm_shutdown();
+        g_modelPath.clear();
+    }
+
+    int ret = llm_init(model_path.c_str(), gpu_layers, context_size);
+    if (ret == LLM_INIT_OK)
+    {
+        g_modelPath = model_path;
+    }
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CONNECTION
+
+struct HostSlot {
+    int                   query_id     = -1;
+    bool                  final        = false;  // final status read from the task (which is gone from llm_wrapper)
+    bool                  published    = false;  // final status visible to the client
+    int                   final_status = TASK_QUEUED;
+    std::string           text;
+    size_t                written      = 0;      // bytes of text already in the ring
+    HostClock::time_point next_poll;             // queued tasks are polled less often
+    bool                  released     = false;  // client is done with it, freed once the task ends
+};
+
+struct HostConnection {
+    int                     index   = 0;
+    HANDLE                  pipe    = INVALID_HANDLE_VALUE;
+    HANDLE                  mapping = nullptr;
+    LLMIpcShared *          shared  = nullptr;
+    std::string             mapping_name;
+    std::mutex              mutex;    // guards slots and owned
+    HostSlot                slots[LLM_IPC_SLOTS];
+    std::unordered_set<int> owned;    // tasks created by this client, stopped when it goes away
+    std::atomic<bool>       running{ true };
+};
+
+static int assign_slot(HostConnection * conn, int query_id)
+{
+    std::lock_guard<std::mutex> lock(conn->mutex);
+
+    conn->owned.insert(query_id);
+
+    for (int i = 0; i < LLM_IPC_SLOTS; i++)
+    {
+        HostSlot & slot = conn->slots[i];
+        if (slot.query_id < 0)
+        {
+            slot              = HostSlot();
+            slot.query_id     = query_id;
+
+            LLMIpcSlot & shared = conn->shared->slots[i];
+            shared.status.store(TASK_QUEUED);
+            shared.generated_tokens.store(0);
+            shared.max_tokens.store(0);
+            shared.flags.store(0);
+            shared.base.store(shared.write_pos.load());
+            shared.read_pos.store(shared.write_pos.load());
+            shared.query_id.store(query_id);
+            return i;
+        }
+    }
+
+    // Client polls this one through the pipe
+    return -1;
+}
+
+static void release_slot(HostConnection * conn, int index)
+{
+    if ((index < 0) || (index >= LLM_IPC_SLOTS))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(conn->mutex);
+
+    HostSlot & slot = conn->slots[index];
+    if ((slot.query_id >= 0) && (!slot.final))
+    {
+        // Task still going (e.g. a session that was just ended), the pump has to read it until it
+        // ends so llm_wrapper can let it go
+        slot.released = true;
+        return;
+    }
+
+    slot = HostSlot();
+    conn->shared->slots[index].query_id.store(-1);
+}
+
+// Writes as much of the slot's text as fits in the ring, returns true if all of it is there
+static bool write_slot(HostSlot & slot, LLMIpcSlot & shared)
+{
+    uint64_t write_pos = shared.write_pos.load();
+    uint64_t limit     = shared.read_pos.load() + LLM_IPC_RING_SIZE;
+
+    while ((slot.written < slot.text.size()) && (write_pos < limit))
+    {
+        uint32_t offset = (uint32_t) (write_pos % LLM_IPC_RING_SIZE);
+        uint32_t count  = (uint32_t) std::min<uint64_t>({ slot.text.size() - slot.written, limit - write_pos, LLM_IPC_RING_SIZE - offset });
+        std::memcpy(shared.ring + offset, slot.text.data() + slot.written, count);
+        slot.written += count;
+        write_pos    += count;
+    }
+
+    shared.write_pos.store(write_pos);
+
+    return slot.written == slot.text.size();
+}
+
+static const int PUMP_ACTIVE_MS = 2;    // something is generating
+static const int PUMP_IDLE_MS   = 20;
+static const int PUMP_QUEUED_MS = 100;  // tasks waiting to start, e.g. a session while the life is played
+
+// Polls the tasks that have a slot and streams their new text into shared memory
+static void pump_connection(HostConnection * conn)
+{
+    std::vector<char> buffer(LLM_IPC_RING_SIZE);
+
+    while (conn->running)
+    {
+        bool                  generating = false;
+        HostClock::time_point now        = HostClock::now();
+
+        for (int i = 0; i < LLM_IPC_SLOTS; i++)
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+
+            HostSlot & slot = conn->slots[i];
+            if ((slot.query_id < 0) || (slot.published))
+            {
+                continue;
+            }
+
+            LLMIpcSlot & shared = conn->shared->slots[i];
+
+            if ((!slot.final) && (now >= slot.next_poll))
+            {
+                int offset = 0, length = 0, generated_tokens = 0, max_tokens = 0, flags = 0;
+                int status;
+                while (true)
+                {
+                    status = llm_get_answer_from(slot.query_id, (int) slot.text.size(), buffer.data(), (int) buffer.size(), &offset, &length,
+                                                 &generated_tokens, &max_tokens, &flags);
+                    if (length - offset <= (int) buffer.size())
+                    {
+                        break;
+                    }
+
+                    // Didn't fit (so the task is still there), ask again with enough room
+                    buffer.resize(length - offset);
+                }
+
+                if (offset < (int) slot.text.size())
+                {
+                    // Not just new text at the end, send it all again
+                    shared.base.store(shared.write_pos.load());
+                    slot.written = 0;
+                    slot.text.clear();
+                }
+                slot.text.append(buffer.data(), length - offset);
+
+                shared.generated_tokens.store(generated_tokens);
+                shared.max_tokens.store(max_tokens);
+                shared.flags.store(flags);
+
+                if (is_final_status(status))
+                {
+                    slot.final        = true;
+                    slot.final_status = status;
+                    conn->owned.erase(slot.query_id);
+                }
+                else
+                {
+                    shared.status.store(status);
+                }
+
+                slot.next_poll = (status == TASK_QUEUED) ? (now + std::chrono::milliseconds(PUMP_QUEUED_MS)) : (now);
+            }
+
+            if (slot.released)
+            {
+                // Nobody reading, so nothing to write
+                if (slot.final)
+                {
+                    slot = HostSlot();
+                    shared.query_id.store(-1);
+                }
+                continue;
+            }
+
+            if ((write_slot(slot, shared)) && (slot.final))
+            {
+                shared.status.store(slot.final_status);
+                slot.published = true;
+            }
+
+            if ((slot.final) || (shared.status.load() != TASK_QUEUED))
+            {
+                generating = true;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds((generating) ? (PUMP_ACTIVE_MS) : (PUMP_IDLE_MS)));
+    }
+}
+
+// The task's state is about to change, so the pump shouldn't wait to look at it
+static void wake_slot(HostConnection * conn, int query_id)
+{
+    std::lock_guard<std::mutex> lock(conn->mutex);
+
+    for (HostSlot & slot : conn->slots)
+    {
+        if (slot.query_id == query_id)
+        {
+            slot.next_poll = HostClock::time_point();
+        }
+    }
+}
+
+static void forget_task(HostConnection * conn, int status, int query_id)
+{
+    if (is_final_status(status))
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->owned.erase(query_id);
+    }
+}
+
+// Runs one request, returns false when the client is done
+static bool serve_request(HostConnection * conn, const LLMIpcRequest & request, const std::string & text,
+                          LLMIpcResponse & response, std::string & response_text)
+{
+    const int * ints   = request.ints;
+    const float * floats = request.floats;
+
+    switch (request.op)
+    {
+    case LLM_OP_HELLO:
+        response.ret  = (int) LLM_IPC_VERSION;
+        response_text = conn->mapping_name;
+        break;
+    case LLM_OP_INIT:
+        response.ret = host_init(text, ints[0], ints[1]);
+        break;
+    case LLM_OP_SHUTDOWN:
+        // Model stays loaded for the next client
+        return false;
+    case LLM_OP_QUERY:
+        response.ret = llm_query(text.c_str(), ints[0]);
+        if (response.ret >= 0)
+        {
+            response.ints[0] = assign_slot(conn, response.ret);
+        }
+        break;
+    case LLM_OP_SET_TERMINATION_TOKEN:
+        response.ret = llm_set_termination_token(ints[0], text.c_str());
+        break;
+    case LLM_OP_SET_SAMPLER_IMPROVED:
+        response.ret = llm_set_sampler_improved(ints[0], floats[0], floats[1], ints[1] != 0, floats[2], ints[2]);
+        break;
+    case LLM_OP_SET_SAMPLER_GREEDY:
+        response.ret = llm_set_sampler_greedy(ints[0]);
+        break;
+    case LLM_OP_SET_SEED:
+        response.ret = llm_set_seed(ints[0], (unsigned int) ints[1]);
+        break;
+    case LLM_OP_SET_DEADLINE:
+        response.ret = llm_set_deadline(ints[0], ints[1], ints[2]);
+        break;
+    case LLM_OP_SET_DEADLINE_DEGRADE:
+        response.ret = llm_set_deadline_degrade(ints[0], ints[1]);
+        break;
+    case LLM_OP_GET_THROUGHPUT:
+        llm_get_throughput(&response.floats[0], &response.floats[1]);
+        break;
+    case LLM_OP_SET_RETAIN:
+        response.ret = llm_set_retain(ints[0], ints[1]);
+        break;
+    case LLM_OP_SET_RETAIN_LIMIT:
+        llm_set_retain_limit(ints[0]);
+        break;
+    case LLM_OP_CONTINUE:
+        response.ret = llm_continue(ints[0], text.c_str(), ints[1]);
+        if (response.ret >= 0)
+        {
+            response.ints[0] = assign_slot(conn, response.ret);
+        }
+        break;
+    case LLM_OP_SET_SPECULATION:
+        response.ret = llm_set_speculation(ints[0], ints[1] != 0, ints[2], ints[3]);
+        break;
+    case LLM_OP_GET_SPECULATION_STATS:
+        response.ret = llm_get_speculation_stats(ints[0], &response.ints[0], &response.ints[1]);
+        break;
+    case LLM_OP_LOAD_ADAPTER:
+        response.ret = llm_load_adapter(text.c_str());
+        break;
+    case LLM_OP_UNLOAD_ADAPTER:
+        response.ret = llm_unload_adapter(ints[0]);
+        break;
+    case LLM_OP_SET_ADAPTER:
+        response.ret = llm_set_adapter(ints[0], ints[1], floats[0]);
+        break;
+    case LLM_OP_START:
+        response.ret = llm_start(ints[0]);
+        wake_slot(conn, ints[0]);
+        break;
+    case LLM_OP_STOP:
+        response.ret = llm_stop(ints[0]);
+        wake_slot(conn, ints[0]);
+        break;
+    case LLM_OP_GET_ANSWER:
+        {
+            std::vector<char> buffer(std::max(1, std::min(ints[1], (int) LLM_IPC_MAX_TEXT)));
+            response.ret  = llm_get_answer_ex(ints[0], buffer.data(), (int) buffer.size(), &response.ints[0], &response.ints[1], &response.ints[2]);
+            response_text = buffer.data();
+            forget_task(conn, response.ret, ints[0]);
+        }
+        break;
+    case LLM_OP_RELEASE_SLOT:
+        release_slot(conn, ints[0]);
+        break;
+    case LLM_OP_SESSION_BEGIN:
+        response.ret = llm_session_begin_ex(text.c_str(), ints[0], floats[0]);
+        if (response.ret >= 0)
+        {
+            response.ints[0] = assign_slot(conn, response.ret);
+        }
+        break;
+    case LLM_OP_SESSION_APPEND:
+        response.ret = llm_session_append(ints[0], text.c_str());
+        break;
+    case LLM_OP_SESSION_GENERATE:
+        response.ret = llm_session_generate(ints[0], text.c_str(), ints[1]);
+        wake_slot(conn, ints[0]);
+        break;
+    case LLM_OP_SESSION_END:
+        response.ret = llm_session_end(ints[0]);
+        wake_slot(conn, ints[0]);
+        break;
+    case LLM_OP_CACHE_ENABLE:
+        llm_cache_enable(ints[0] != 0);
+        break;
+    case LLM_OP_CACHE_OPEN:
+        response.ret = llm_cache_open(text.c_str());
+        break;
+    case LLM_OP_CACHE_CLEAR:
+        llm_cache_clear();
+        break;
+    default:
+        Log("[%i] Unknown op %i!", conn->index, request.op);
+        response.ret = -1;
+        break;
+    }
+
+    return true;
+}
+
+static void serve_connection(HostConnection * conn)
+{
+    Log("[%i] Client connected", conn->index);
+
+    std::thread pump([conn]() { pump_connection(conn); });
+
+    std::string text;
+    std::string response_text;
+    bool        done = false;
+
+    while (!done)
+    {
+        LLMIpcRequest request;
+        if ((!ipc_pipe_read(conn->pipe, &request, sizeof(request))) || (request.text_len > LLM_IPC_MAX_TEXT))
+        {
+            break;
+        }
+
+        text.assign(request.text_len, '\0');
+        if ((request.text_len > 0) && (!ipc_pipe_read(conn->pipe, &text[0], request.text_len)))
+        {
+            break;
+        }
+
+        LLMIpcResponse response = {};
+        response_text.clear();
+
+        done = !serve_request(conn, request, text, response, response_text);
+
+        response.text_len = (uint32_t) response_text.size();
+        if ((!ipc_pipe_write(conn->pipe, &response, sizeof(response))) ||
+            ((response.text_len > 0) && (!ipc_pipe_write(conn->pipe, response_text.data(), response.text_len))))
+        {
+            break;
+        }
+    }
+
+    conn->running = false;
+    pump.join();
+
+    // Whatever the client left behind is of no use to anyone. Tasks that never started are done as
+    // soon as they're stopped, only the ones generating need some time to notice.
+    std::vector<int> owned(conn->owned.begin(), conn->owned.end());
+    for (int id : owned)
+    {
+        llm_stop(id);
+    }
+    for (int id : owned)
+    {
+        for (int i = 0; i < 500; i++)
+        {
+            if (is_final_status(llm_get_answer_ex(id, nullptr, 0, nullptr, nullptr, nullptr)))
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    Log("[%i] Client disconnected (%i tasks dropped)", conn->index, (int) owned.size());
+
+    FlushFileBuffers(conn->pipe);
+    DisconnectNamedPipe(conn->pipe);
+    CloseHandle(conn->pipe);
+    UnmapViewOfFile(conn->shared);
+    CloseHandle(conn->mapping);
+
+    std::lock_guard<std::mutex> lock(g_hostMutex);
+    g_connections--;
+    if (g_connections == 0)
+    {
+        g_idleSince = HostClock::now();
+    }
+}
+
+static std::unique_ptr<HostConnection> create_connection(HANDLE pipe, const std::string & pipe_name, int index)
+{
+    auto conn          = std::make_unique<HostConnection>();
+    conn->index        = index;
+    conn->pipe         = pipe;
+    conn->mapping_name = "Local\\" + pipe_name + "_" + std::to_string(GetCurrentProcessId()) + "_" + std::to_string(index);
+
+    conn->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD) sizeof(LLMIpcShared), conn->mapping_name.c_str());
+    if (!conn->mapping)
+    {
+        return nullptr;
+    }
+
+    conn->shared = (LLMIpcShared *) MapViewOfFile(conn->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LLMIpcShared));
+    if (!conn->shared)
+    {
+        CloseHandle(conn->mapping);
+        return nullptr;
+    }
+
+    // Fresh mappings are zeroed, which is a valid state for the atomics
+    conn->shared->version = LLM_IPC_VERSION;
+    for (int i = 0; i < LLM_IPC_SLOTS; i++)
+    {
+        conn->shared->slots[i].query_id.store(-1);
+    }
+
+    return conn;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// MAIN
+
+int main(int argc, char ** argv)
+{
+    std::string pipe_name    = LLM_IPC_DEFAULT_PIPE;
+    std::string model_path;
+    int         gpu_layers   = 999;
+    int         context_size = 2048;
+    int         idle_timeout = 120;
+
+    for (int i = 1; i < argc - 1; i++)
+    {
+        if (strcmp(argv[i], "--pipe") == 0) pipe_name = argv[++i];
+        else if (strcmp(argv[i], "--model") == 0) model_path = argv[++i];
+        else if (strcmp(argv[i], "--gpu-layers") == 0) gpu_layers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--context") == 0) context_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--idle-timeout") == 0) idle_timeout = atoi(argv[++i]);
+    }
+
+    if (!model_path.empty())
+    {
+        Log("Preloading %s...", model_path.c_str());
+        if (host_init(model_path, gpu_layers, context_size) != LLM_INIT_OK)
+        {
+            Log("Failed to load model!");
+        }
+    }
+
+    std::string pipe_path = "\\\\.\\pipe\\" + pipe_name;
+
+    Log("Listening on %s", pipe_path.c_str());
+
+    if (idle_timeout > 0)
+    {
+        // Nobody would know this is still holding the model (and the GPU memory), so leave when unused
+        std::thread([idle_timeout]() {
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+
+                std::lock_guard<std::mutex> lock(g_hostMutex);
+                if ((g_connections == 0) && (HostClock::now() - g_idleSince >= std::chrono::seconds(idle_timeout)))
+                {
+                    Log("No clients for %i s, exiting", idle_timeout);
+                    llm_shutdown();
+                    ExitProcess(0);
+                }
+            }
+        }).detach();
+    }
+
+    for (int index = 0;; index++)
+    {
+        HANDLE pipe = CreateNamedPipeA(pipe_path.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                       PIPE_UNLIMITED_INSTANCES, 64 * 1024, 64 * 1024, 0, nullptr);
+        if (pipe == INVALID_HANDLE_VALUE)
+        {
+            Log("Failed to create pipe!");
+            return 1;
+        }
+
+        if ((!ConnectNamedPipe(pipe, nullptr)) && (GetLastError() != ERROR_PIPE_CONNECTED))
+        {
+            CloseHandle(pipe);
+            continue;
+        }
+
+        std::unique_ptr<HostConnection> conn = create_connection(pipe, pipe_name, index);
+        if (!conn)
+        {
+            Log("Failed to create shared memory for client %i!", index);
+            CloseHandle(pipe);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(g_hostMutex);
+            g_connections++;
+        }
+
+        std::thread([conn = std::move(conn)]() mutable { serve_connection(conn.get()); }).detach();
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+
+#include <atomic>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Protocol between llm_wrapper in client mode (llm_connect_host) and llm_host.
+//
+// Calls go through a named pipe: a request header, followed by text_len bytes of text, answered by
+// a response header followed by its own text. The answers being generated don't go through the pipe:
+// each connection gets a shared memory block with a few slots, each one a ring buffer where the host
+// writes the text of a task as it grows, so polling for answers is just reading memory.
+
+// Status codes of the C API, shared by llm_wrapper and llm_host
+enum LLMInitStatus { LLM_INIT_OK = 0, LLM_INIT_ERROR = 1, LLM_INIT_MODEL_NOT_FOUND = 2 };
+
+enum LLMTaskStatus {
+    TASK_QUEUED     = 0,
+    TASK_RUNNING    = 1,
+    TASK_FINISHED   = 2,
+    TASK_ERROR      = 3,
+    TASK_INVALID_ID = 4,
+    TASK_INTERRUPT  = 5
+};
+
+static inline bool is_final_status(int status)
+{
+    return (status == TASK_FINISHED) || (status == TASK_ERROR) || (status == TASK_INTERRUPT) || (status == TASK_INVALID_ID);
+}
+
+#define LLM_IPC_DEFAULT_PIPE "taletoy_llm"
+
+static const uint32_t LLM_IPC_VERSION   = 1;
+static const int      LLM_IPC_SLOTS     = 8;
+static const uint32_t LLM_IPC_RING_SIZE = 64 * 1024;
+static const uint32_t LLM_IPC_MAX_TEXT  = 4 * 1024 * 1024;
+
+enum LLMIpcOp {
+    LLM_OP_HELLO = 0,
+    LLM_OP_INIT,
+    LLM_OP_SHUTDOWN,
+    LLM_OP_QUERY,
+    LLM_OP_SET_TERMINATION_TOKEN,
+    LLM_OP_SET_SAMPLER_IMPROVED,
+    LLM_OP_SET_SAMPLER_GREEDY,
+    LLM_OP_SET_SEED,
+    LLM_OP_SET_DEADLINE,
+    LLM_OP_SET_DEADLINE_DEGRADE,
+    LLM_OP_GET_THROUGHPUT,
+    LLM_OP_SET_RETAIN,
+    LLM_OP_SET_RETAIN_LIMIT,
+    LLM_OP_CONTINUE,
+    LLM_OP_SET_SPECULATION,
+    LLM_OP_GET_SPECULATION_STATS,
+    LLM_OP_LOAD_ADAPTER,
+    LLM_OP_UNLOAD_ADAPTER,
+    LLM_OP_SET_ADAPTER,
+    LLM_OP_START,
+    LLM_OP_STOP,
+    LLM_OP_GET_ANSWER,  // only used for tasks that didn't get a slot
+    LLM_OP_RELEASE_SLOT,
+    LLM_OP_SESSION_BEGIN,
+    LLM_OP_SESSION_APPEND,
+    LLM_OP_SESSION_GENERATE,
+    LLM_OP_SESSION_END,
+    LLM_OP_CACHE_ENABLE,
+    LLM_OP_CACHE_OPEN,
+    LLM_OP_CACHE_CLEAR,
+};
+
+struct LLMIpcRequest {
+    int32_t  op;
+    int32_t  ints[4];
+    float    floats[3];
+    uint32_t text_len;
+};
+
+struct LLMIpcResponse {
+    int32_t  ret;
+    int32_t  ints[3];
+    float    floats[2];
+    uint32_t text_len;
+};
+
+// The host writes the text and then moves write_pos, and only sets a final status once all the text
+// is written, so a client that sees a final status already has everything up to write_pos.
+// If the text changes other than by growing (e.g. replaced by an error), base moves to write_pos and
+// the text is written again from there.
+struct LLMIpcSlot {
+    std::atomic<int32_t>  query_id;
+    std::atomic<int32_t>  status;
+    std::atomic<int32_t>  generated_tokens;
+    std::atomic<int32_t>  max_tokens;
+    std::atomic<int32_t>  flags;
+    std::atomic<uint64_t> base;       // ring position where the current text starts
+    std::atomic<uint64_t> write_pos;  // moved by the host
+    std::atomic<uint64_t> read_pos;   // moved by the client, the host never writes past read_pos + ring size
+    char                  ring[LLM_IPC_RING_SIZE];
+};
+
+struct LLMIpcShared {
+    uint32_t   version;
+    LLMIpcSlot slots[LLM_IPC_SLOTS];
+};
+
+static inline bool ipc_pipe_write(HANDLE pipe, const void * data, uint32_t size)
+{
+    const char * bytes = (const char *) data;
+    while (size > 0)
+    {
+        DWORD written = 0;
+        if ((!WriteFile(pipe, bytes, size, &written, nullptr)) || (written == 0))
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static inline bool ipc_pipe_read(HANDLE pipe, void * data, uint32_t size)
+{
+    char * bytes = (char *) data;
+    while (size > 0)
+    {
+        DWORD read = 0;
+        if ((!ReadFile(pipe, bytes, size, &read, nullptr)) || (read == 0))
+        {
+            return false;
+        }
+        bytes += read;
+        size -= read;
+    }
+    return true;
+}
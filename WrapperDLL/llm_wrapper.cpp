@@ -1,10 +1,13 @@
 #include <cstring>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <string>
 #include <thread>
 #include <chrono>
 #include <unordered_map>
+#include <map>
 #include <filesystem>
 #include <vector>
 #include <algorithm>
@@ -14,6 +17,7 @@
 #include <cstdio>
 #include <cstdarg>
 #include "llama.h"
+#include "llm_ipc.h"
     
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // LOG STUFF
@@ -99,18 +103,22 @@ void llama_log_callback(enum ggml_log_level level, const char * text, void * use
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-enum LLMInitStatus { LLM_INIT_OK = 0, LLM_INIT_ERROR = 1, LLM_INIT_MODEL_NOT_FOUND = 2 };
+// LLMInitStatus and LLMTaskStatus are in llm_ipc.h
 
-enum LLMTaskStatus {
-    TASK_QUEUED     = 0,
-    TASK_RUNNING    = 1,
-    TASK_FINISHED   = 2,
-    TASK_ERROR      = 3,
-    TASK_INVALID_ID = 4,
-    TASK_INTERRUPT  = 5
+enum LLMSamplerType { SAMPLER_GREEDY = 0, SAMPLER_TEMP_TOP_P = 1 };
+
+// Extra information about how a task finished (llm_get_answer_ex)
+enum LLMTaskFlags { TASK_FLAG_NONE = 0, TASK_FLAG_DEADLINE = 1, TASK_FLAG_DEGRADED = 2, TASK_FLAG_CACHED = 4 };
+
+// What to do when a task is projected to miss its total deadline
+enum LLMDeadlineDegrade {
+    DEGRADE_NONE   = 0,
+    DEGRADE_GREEDY = 1,  // switch to the (cheaper) greedy sampler
+    DEGRADE_SHRINK = 2,  // reduce max_tokens to what fits in the remaining time
+    DEGRADE_STEER  = 4   // close the answer with the terminator when the deadline expires
 };
 
-enum LLMSamplerType { SAMPLER_GREEDY = 0, SAMPLER_TEMP_TOP_P = 1 };
+using LLMClock = std::chrono::steady_clock;
 
 struct LLMTask {
     int             id               = -1;
@@ -133,6 +141,48 @@ struct LLMTask {
     float          repetition_penalty     = 1.1f;  // >1.0 = penalize
     int            repetition_window      = 64;    // how many last tokens to look at
 
+    // Seed control - with a seed set (or the greedy sampler), the same prompt gives the same answer
+    bool           seed_set               = false;
+    uint32_t       seed                   = 0;
+    std::mt19937   rng;
+
+    // Response cache
+    bool           cacheable              = false;
+    uint64_t       cache_key              = 0;
+
+    // Session state (prompt streamed in with llm_session_append, see run_session)
+    bool                     session          = false;
+    std::vector<std::string> session_pending;           // pieces not tokenized yet, one per append
+    bool                     session_generate = false;
+    bool                     session_discard  = false;
+    std::condition_variable  session_cv;
+
+    // Prompt lookup speculation (see generate_answer)
+    bool           spec_enabled           = false;
+    int            spec_ngram             = 3;     // longest n-gram to look up
+    int            spec_draft_max         = 8;     // max tokens proposed at once
+    int            spec_drafted           = 0;
+    int            spec_accepted          = 0;
+
+    // Tokens in the context's KV cache, plus the ones that were generated but never decoded (the last
+    // one before stopping), so a retained task can be continued (see llm_continue)
+    std::vector<llama_token> context_tokens;
+    std::vector<llama_token> kv_pending;
+    int                      retain_ms     = 0;
+    LLMClock::time_point     retain_expiry;
+    bool                     continuation  = false;
+
+    // LoRA adapter (handle from llm_load_adapter, 0 = base model only)
+    int            adapter_id             = 0;
+    float          adapter_scale          = 1.0f;
+
+    // Deadlines (in ms, 0 = none), measured from the moment generation starts
+    int               deadline_first_ms = 0;
+    int               deadline_total_ms = 0;
+    int               deadline_degrade  = DEGRADE_NONE;
+    LLMClock::time_point start_time;
+    int               flags             = TASK_FLAG_NONE;
+
     std::vector<llama_token> token_history;                   
     void clear()
     {
@@ -155,6 +205,29 @@ struct LLMTask {
         use_repetition_penalty = false;
         repetition_penalty     = 1.1f;
         repetition_window      = 64;
+        seed_set               = false;
+        seed                   = 0;
+        cacheable              = false;
+        cache_key              = 0;
+        session                = false;
+        session_generate       = false;
+        session_discard        = false;
+        session_pending.clear();
+        spec_enabled           = false;
+        spec_ngram             = 3;
+        spec_draft_max         = 8;
+        spec_drafted           = 0;
+        spec_accepted          = 0;
+        context_tokens.clear();
+        kv_pending.clear();
+        retain_ms              = 0;
+        continuation           = false;
+        adapter_id             = 0;
+        adapter_scale          = 1.0f;
+        deadline_first_ms      = 0;
+        deadline_total_ms      = 0;
+        deadline_degrade       = DEGRADE_NONE;
+        flags                  = TASK_FLAG_NONE;
         token_history.clear();
     }
 };
@@ -165,8 +238,312 @@ static int                                               g_nextId = 1;
 static llama_model *                                     g_model  = nullptr;
 static std::mutex                                        g_llmMutex;
 static int                                               g_ContextSize = 2048;
+static std::string                                       g_modelId;
+static std::atomic<int>                                  g_sessionWorkers{ 0 };
+
+// Finished tasks kept alive (with their context) for llm_continue, guarded by g_taskMutex
+static std::unordered_map<int, std::unique_ptr<LLMTask>> g_retained;
+static int                                               g_retainMaxContexts = 2;
+
+// Speculation stats (drafted, accepted) of the last tasks whose answer was read, since the final
+// counts are only known once the task is gone from g_tasks. Guarded by g_taskMutex.
+static std::map<int, std::pair<int, int>> g_specStats;
+static const size_t                       SPEC_STATS_KEEP = 32;
+
+// LoRA adapters loaded on top of g_model (guarded by g_llmMutex). Contexts are created per task, so
+// switching adapter is just a matter of attaching a different one to the new context.
+struct LLMAdapter {
+    std::string          path;
+    llama_adapter_lora * adapter = nullptr;
+};
+
+static std::unordered_map<int, LLMAdapter> g_adapters;
+static int                                 g_nextAdapterId = 1;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// RESPONSE CACHE
+// Deterministic tasks (greedy sampler or fixed seed) always produce the same answer for the same
+// model/tokens/parameters, so we keep finished answers around and skip the decode entirely.
+// Optionally, entries are persisted to a file so they survive between runs.
+
+struct LLMCacheEntry {
+    std::string result;
+    int         generated_tokens = 0;
+};
+
+static std::mutex                                  g_cacheMutex;
+static bool                                        g_cacheEnabled = false;
+static std::unordered_map<uint64_t, LLMCacheEntry> g_cache;
+static std::string                                 g_cachePath;
+
+static const char     CACHE_FILE_MAGIC[8]   = { 'T', 'T', 'C', 'A', 'C', 'H', 'E', '2' };
+static const uint32_t CACHE_MAX_ENTRY_BYTES = 1024 * 1024;
+
+static uint64_t hash_bytes(uint64_t h, const void * data, size_t size)
+{
+    // FNV-1a, 64 bits
+    const uint8_t * bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template <typename T> static uint64_t hash_value(uint64_t h, const T & value)
+{
+    return hash_bytes(h, &value, sizeof(T));
+}
+
+static uint64_t hash_string(uint64_t h, const std::string & str)
+{
+    h = hash_value(h, (uint64_t) str.size());
+    return hash_bytes(h, str.data(), str.size());
+}
+
+static uint64_t compute_cache_key(const LLMTask * task, const std::vector<llama_token> & tokens)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    h = hash_string(h, g_modelId);
+    h = hash_value(h, (uint64_t) tokens.size());
+    h = hash_bytes(h, tokens.data(), tokens.size() * sizeof(llama_token));
+    h = hash_value(h, task->max_tokens);
+    h = hash_value(h, task->terminator_set);
+    h = hash_string(h, task->terminator);
+    h = hash_value(h, (int) task->sampler_type);
+    h = hash_value(h, task->spec_enabled);  // batched verification can round logits differently
+
+    if (task->adapter_id > 0)
+    {
+        std::lock_guard<std::mutex> lock(g_llmMutex);
+
+        auto it = g_adapters.find(task->adapter_id);
+        if (it != g_adapters.end())
+        {
+            h = hash_string(h, it->second.path);
+            h = hash_value(h, task->adapter_scale);
+        }
+    }
+
+    if (task->sampler_type == SAMPLER_TEMP_TOP_P)
+    {
+        h = hash_value(h, task->temperature);
+        h = hash_value(h, task->top_p);
+        h = hash_value(h, task->use_repetition_penalty);
+        h = hash_value(h, task->repetition_penalty);
+        h = hash_value(h, task->repetition_window);
+        h = hash_value(h, task->seed);
+    }
+
+    return h;
+}
+
+static bool cache_lookup(uint64_t key, LLMCacheEntry & entry)
+{
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    auto it = g_cache.find(key);
+    if (it == g_cache.end())
+    {
+        return false;
+    }
+
+    entry = it->second;
+    return true;
+}
+
+// Records are appended as they're generated, so a crash can leave a partial one at the end
+static uint64_t cache_record_checksum(uint64_t key, int32_t generated_tokens, const std::string & result)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    h = hash_value(h, key);
+    h = hash_value(h, generated_tokens);
+    return hash_string(h, result);
+}
+
+static void cache_store(uint64_t key, const std::string & result, int generated_tokens)
+{
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    if (!g_cacheEnabled)
+    {
+        return;
+    }
+
+    LLMCacheEntry & entry   = g_cache[key];
+    entry.result            = result;
+    entry.generated_tokens  = generated_tokens;
+
+    if ((g_cachePath.empty()) || (result.size() > CACHE_MAX_ENTRY_BYTES))
+    {
+        return;
+    }
+
+    FILE * file = fopen(g_cachePath.c_str(), "ab");
+    if (!file)
+    {
+        Log("\tCan't append to cache file %s!", g_cachePath.c_str());
+        return;
+    }
+
+    uint32_t len = (uint32_t) result.size();
+    int32_t  gen = generated_tokens;
+    uint64_t sum = cache_record_checksum(key, gen, result);
+    fwrite(&key, sizeof(key), 1, file);
+    fwrite(&gen, sizeof(gen), 1, file);
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite(&sum, sizeof(sum), 1, file);
+    fwrite(result.data(), 1, len, file);
+    fclose(file);
+}
+
+// Creates an empty cache file (just the header), replacing any existing one
+static bool cache_create_file(const std::string & path)
+{
+    FILE * file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    fwrite(CACHE_FILE_MAGIC, 1, sizeof(CACHE_FILE_MAGIC), file);
+    fclose(file);
+    return true;
+}
+
+// Loads all records of a cache file, creating it if it doesn't exist yet
+static bool cache_load_file(const std::string & path)
+{
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return cache_create_file(path);
+    }
+
+    char magic[sizeof(CACHE_FILE_MAGIC)];
+    if ((fread(magic, 1, sizeof(magic), file) != sizeof(magic)) || (memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) != 0))
+    {
+        fclose(file);
+
+        if (memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic) - 1) == 0)
+        {
+            // Older version, it's just a cache so start over
+            Log("\tOld cache file %s, recreating it", path.c_str());
+            return cache_create_file(path);
+        }
+
+        Log("\tInvalid cache file %s!", path.c_str());
+        return false;
+    }
+
+    int  count    = 0;
+    long good_end = ftell(file);  // end of the last complete record
+    while (true)
+    {
+        uint64_t key;
+        int32_t  gen;
+        uint32_t len;
+        uint64_t sum;
+        if ((fread(&key, sizeof(key), 1, file) != 1) ||
+            (fread(&gen, sizeof(gen), 1, file) != 1) ||
+            (fread(&len, sizeof(len), 1, file) != 1) ||
+            (fread(&sum, sizeof(sum), 1, file) != 1) ||
+            (len > CACHE_MAX_ENTRY_BYTES))
+        {
+            break;
+        }
+
+        LLMCacheEntry entry;
+        entry.generated_tokens = gen;
+        entry.result.resize(len);
+        if (((len > 0) && (fread(&entry.result[0], 1, len, file) != len)) ||
+            (cache_record_checksum(key, gen, entry.result) != sum))
+        {
+            // Partial or damaged record (crash while writing?), ignore the rest
+            break;
+        }
+
+        g_cache[key] = std::move(entry);
+        count++;
+        good_end = ftell(file);
+    }
+
+    fclose(file);
+
+    // Cut anything after the last good record, otherwise new records would be appended after the
+    // bad one and be read as part of it
+    std::error_code error;
+    uintmax_t       size = std::filesystem::file_size(path, error);
+    if ((!error) && (size > (uintmax_t) good_end))
+    {
+        Log("\tDropping damaged data at the end of %s", path.c_str());
+
+        std::filesystem::resize_file(path, (uintmax_t) good_end, error);
+        if (error)
+        {
+            Log("\tCan't truncate cache file %s!", path.c_str());
+            return false;
+        }
+    }
+
+    Log("\tLoaded %i cache entries from %s", count, path.c_str());
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// THROUGHPUT
+// Running estimate of the speed of the loaded model, used to project if a task will make its deadline.
+
+struct LLMThroughput {
+    double decode_tps  = 0.0;  // generated tokens per second (sample + decode)
+    double prefill_tps = 0.0;  // prompt tokens per second
+};
+
+static std::mutex    g_throughputMutex;
+static LLMThroughput g_throughput;
+
+static const double THROUGHPUT_SMOOTHING = 0.2;
+
+static void update_rate(double & rate, double tokens, double seconds)
+{
+    if ((tokens <= 0.0) || (seconds <= 0.0))
+    {
+        return;
+    }
+
+    double sample = tokens / seconds;
+    rate          = (rate <= 0.0) ? (sample) : (rate + (sample - rate) * THROUGHPUT_SMOOTHING);
+}
+
+static void record_decode_throughput(int tokens, double seconds)
+{
+    std::lock_guard<std::mutex> lock(g_throughputMutex);
+    update_rate(g_throughput.decode_tps, tokens, seconds);
+}
+
+static void record_prefill_throughput(int tokens, double seconds)
+{
+    std::lock_guard<std::mutex> lock(g_throughputMutex);
+    update_rate(g_throughput.prefill_tps, tokens, seconds);
+}
+
+static double get_decode_throughput()
+{
+    std::lock_guard<std::mutex> lock(g_throughputMutex);
+    return g_throughput.decode_tps;
+}
+
+static double elapsed_ms(LLMClock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(LLMClock::now() - since).count();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static std::vector<llama_token> tokenize_prompt(llama_model * model, const std::string & text)
+static std::vector<llama_token> tokenize_prompt(llama_model * model, const std::string & text, bool add_special = true)
 {
     Log("Tokenizing prompt [%s]", text.c_str());
     if (text.empty())
@@ -185,7 +562,7 @@ static std::vector<llama_token> tokenize_prompt(llama_model * model, const std::
     // This matches current signatures; if your version differs slightly,
     // you may need to tweak the last 1–2 bools.
     int32_t n_tokens = llama_tokenize(vocab, text.c_str(), (int32_t) text.size(), tokens.data(), n_max_tokens,
-                                      /* add_special */ true,
+                                      add_special,
                                       /* parse_special */ false);
 
     if (n_tokens < 0)
@@ -202,8 +579,7 @@ static std::vector<llama_token> tokenize_prompt(llama_model * model, const std::
     return tokens;
 }
 
-static llama_token sample_token_greedy(llama_context * ctx, const llama_vocab * vocab, LLMTask * task) {
-    const float * logits  = llama_get_logits(ctx);
+static llama_token sample_token_greedy(const float * logits, const llama_vocab * vocab, LLMTask * task) {
     const int     n_vocab = llama_vocab_n_tokens(vocab);
 
     int   best_token = 0;
@@ -220,9 +596,8 @@ static llama_token sample_token_greedy(llama_context * ctx, const llama_vocab *
     return (llama_token) best_token;
 }
 
-static llama_token sample_token_temp_top_p(llama_context * ctx, const llama_vocab * vocab, LLMTask * task)
+static llama_token sample_token_temp_top_p(const float * logits, const llama_vocab * vocab, LLMTask * task)
 {
-    const float * logits  = llama_get_logits(ctx);
     const int     n_vocab = llama_vocab_n_tokens(vocab);
 
     // Copy logits so we can modify them safely
@@ -284,7 +659,7 @@ static llama_token sample_token_temp_top_p(llama_context * ctx, const llama_voca
 
     if (candidates.empty()) {
         // Fallback to greedy if something went wrong
-        return sample_token_greedy(ctx, vocab, task);
+        return sample_token_greedy(logits, vocab, task);
     }
 
     for (auto & c : candidates) {
@@ -313,10 +688,9 @@ static llama_token sample_token_temp_top_p(llama_context * ctx, const llama_voca
     // ----------------------------------------------------
     // Random choice from remaining candidates
     // ----------------------------------------------------
-    static thread_local std::mt19937      rng(std::random_device{}());
     std::uniform_real_distribution<float> dist(0.0f, 1.0f);
 
-    float r   = dist(rng);
+    float r   = dist(task->rng);
     float cum = 0.0f;
     for (const auto & c : candidates) {
         cum += c.p;
@@ -328,21 +702,108 @@ static llama_token sample_token_temp_top_p(llama_context * ctx, const llama_voca
     return (llama_token) candidates.back().token;
 }
 
-static void run_task(LLMTask * task)
+// Frees retained tasks whose time is up (or all of them), returns how many were freed.
+// Called with g_taskMutex held.
+static int evict_retained_locked(bool all)
 {
-    task->status = TASK_RUNNING;
+    LLMClock::time_point now   = LLMClock::now();
+    int                  count = 0;
+    for (auto it = g_retained.begin(); it != g_retained.end();)
+    {
+        if ((all) || (now >= it->second->retain_expiry))
+        {
+            Log("Evicting retained task %i", it->first);
 
-    Log("Running gen task...");
+            it->second->clear();
+            it = g_retained.erase(it);
+            count++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
 
-    if (!g_model) {
-        task->result = "[ERROR: model not initialized]";
-        Log("\nModel not initialized!");
-        task->status = TASK_ERROR;
+    return count;
+}
+
+static int evict_retained(bool all)
+{
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    return evict_retained_locked(all);
+}
+
+// Frees the retained tasks closest to expiring until there are at most max_contexts, called with g_taskMutex held
+static void trim_retained(int max_contexts)
+{
+    while ((!g_retained.empty()) && ((int) g_retained.size() > max_contexts))
+    {
+        auto oldest = g_retained.begin();
+        for (auto it = g_retained.begin(); it != g_retained.end(); ++it)
+        {
+            if (it->second->retain_expiry < oldest->second->retain_expiry)
+            {
+                oldest = it;
+            }
+        }
+
+        Log("Evicting retained task %i to make room", oldest->first);
+
+        oldest->second->clear();
+        g_retained.erase(oldest);
+    }
+}
+
+// Keeps a finished task around for llm_continue, called with g_taskMutex held
+static void retain_task(std::unique_ptr<LLMTask> task)
+{
+    // Each context holds a whole KV cache, so there's a limit on how many we keep
+    trim_retained(g_retainMaxContexts - 1);
+
+    if (g_retainMaxContexts <= 0)
+    {
+        task->clear();
         return;
     }
 
-    Log("\nInitializing context...");
+    Log("Retaining task %i for %i ms", task->id, task->retain_ms);
+
+    task->retain_expiry    = LLMClock::now() + std::chrono::milliseconds(task->retain_ms);
+    g_retained[task->id]   = std::move(task);
+}
+
+// Removes a task whose answer was read, retaining it if asked to. Called with g_taskMutex held.
+static void release_task(std::unordered_map<int, std::unique_ptr<LLMTask>>::iterator it)
+{
+    LLMTask * task = it->second.get();
+
+    if (task->spec_enabled)
+    {
+        g_specStats[task->id] = { task->spec_drafted, task->spec_accepted };
+        while (g_specStats.size() > SPEC_STATS_KEEP)
+        {
+            g_specStats.erase(g_specStats.begin());  // ids only grow, so this is the oldest
+        }
+    }
+    if ((task->status == TASK_FINISHED) && (task->retain_ms > 0) && (task->ctx))
+    {
+        std::unique_ptr<LLMTask> retained = std::move(it->second);
+        g_tasks.erase(it);
+        retain_task(std::move(retained));
+    }
+    else
+    {
+        task->clear();
+
+        g_tasks.erase(it);
+    }
+
+    Log("\tTask complete!");
+}
 
+static unsigned get_thread_count()
+{
     unsigned hw = std::thread::hardware_concurrency();
     if (hw == 0)
     {
@@ -352,189 +813,1277 @@ static void run_task(LLMTask * task)
     {
         hw = 16;  // avoid silly values
     }
-    Log("Using %u threads for context", hw);
+    return hw;
+}
+
+static bool create_task_context(LLMTask * task, unsigned n_threads)
+{
+    Log("\nInitializing context...");
+    Log("Using %u threads for context", n_threads);
 
     llama_context_params cparams = llama_context_default_params();
     cparams.n_ctx                = g_ContextSize;
-    cparams.n_threads            = hw;
+    cparams.n_threads            = n_threads;
 
     task->ctx = llama_init_from_model(g_model, cparams);
+    if ((!task->ctx) && (evict_retained(true) > 0))
+    {
+        // Probably out of memory, retained contexts are the first to go
+        task->ctx = llama_init_from_model(g_model, cparams);
+    }
     if (!task->ctx)
     {
         Log("\t[ERROR: cant build context]");
         task->result = "[ERROR: cant build context]";
         task->status = TASK_ERROR;
-        return;
+        return false;
     }
 
-    Log("\nContext initialized...");
-
-    try
+    if (task->adapter_id > 0)
     {
-        Log("\nGet vocab...");
+        std::lock_guard<std::mutex> lock(g_llmMutex);
 
-        const llama_vocab * vocab = llama_model_get_vocab(g_model);
-
-        // ----------------------------------
-        // 1. Tokenize prompt
-        // ----------------------------------
-        std::vector<llama_token> prompt_tokens = tokenize_prompt(g_model, task->prompt);
-        if (prompt_tokens.empty()) {
-            task->result = "[ERROR: failed to tokenize prompt]";
-            Log("\t[ERROR: failed to tokenize prompt]");
+        auto it = g_adapters.find(task->adapter_id);
+        if ((it == g_adapters.end()) || (llama_set_adapter_lora(task->ctx, it->second.adapter, task->adapter_scale) != 0))
+        {
+            Log("\t[ERROR: cant apply adapter %i]", task->adapter_id);
+            task->result = "[ERROR: cant apply adapter]";
             task->status = TASK_ERROR;
-            return;
+            return false;
         }
 
-        // ----------------------------------
-        // 2. Build batch for prompt
-        // ----------------------------------
-        llama_batch prompt_batch = {};
-        prompt_batch.n_tokens    = (int32_t) prompt_tokens.size();
-        prompt_batch.token       = prompt_tokens.data();
-        prompt_batch.pos         = nullptr;  // auto sequential
-        prompt_batch.seq_id      = nullptr;
-        prompt_batch.n_seq_id    = nullptr;
-        prompt_batch.logits      = nullptr;
-
-#ifdef LOG_GENERATION
-        Log("\tBuilding batch for prompt...");
-#endif
-
-        if (llama_decode(task->ctx, prompt_batch) != 0) {
-            task->result = "[ERROR: llama_decode failed for prompt]";
-            Log("\t[ERROR: llama_decode failed for prompt]");
-            task->status = TASK_ERROR;
-            return;
-        }
+        Log("\tUsing adapter %s (scale = %f)", it->second.path.c_str(), task->adapter_scale);
+    }
 
-        // ----------------------------------
-        // 3. Generation loop
-        // ----------------------------------
-        std::string output;
-        const int   max_new_tokens = task->max_tokens;  // tune this for story length
+    Log("\nContext initialized...");
 
-#ifdef LOG_GENERATION
-        Log("\tRunning loop...");
-#endif
+    return true;
+}
 
-        for (int i = 0; i < max_new_tokens; ++i) {
-            // a) Sample next token (greedy)
-            llama_token token;
-            switch (task->sampler_type)
-            {
-                case SAMPLER_TEMP_TOP_P:
-                    token = sample_token_temp_top_p(task->ctx, vocab, task);
-                    break;
-                case SAMPLER_GREEDY:
-                default:
-                    token = sample_token_greedy(task->ctx, vocab, task);
-                    break;
-            }
+static bool decode_tokens(llama_context * ctx, llama_token * tokens, int n_tokens, bool all_logits = false)
+{
+    std::vector<int8_t> logits;
 
-            // b) Stop if EOS
-            llama_token eos = llama_vocab_eos(vocab);
-            if (token == eos) {
-                break;
-            }
+    llama_batch batch = {};
+    batch.n_tokens    = (int32_t) n_tokens;
+    batch.token       = tokens;
+    batch.pos         = nullptr;  // auto sequential
+    batch.seq_id      = nullptr;
+    batch.n_seq_id    = nullptr;
+    batch.logits      = nullptr;  // only the last one
 
-            // c) Convert token to text and append
-            char    buf[512];  // plenty for a single token piece
-            int32_t len = llama_token_to_piece(
-                vocab, token, buf, (int32_t) sizeof(buf),
-                /* lstrip */ 0,
-                /* special */ true  // or false, depending on whether you want special tokens rendered
-            );
+    if (all_logits)
+    {
+        logits.assign(n_tokens, 1);
+        batch.logits = logits.data();
+    }
 
-            if (len > 0)
-            {
-#ifdef LOG_GENERATION
-                Log("\tGenerating token %i/%i...", i, max_new_tokens);
-#endif
+    return llama_decode(ctx, batch) == 0;
+}
 
-                output.append(buf, len);
+static const int PREFILL_CHUNK = 256;
 
-                // copy partial output into task->result in a threadsafe way
-                {
-                    std::lock_guard<std::mutex> lock(g_taskMutex);
-                    task->result = output;
-                }
-            }
+enum LLMPrefillResult { PREFILL_OK, PREFILL_FAILED, PREFILL_DEADLINE };
 
-            if ((task->terminator_set) && (!task->terminator.empty()))
-            {
-                // Check if the terminator sequence exists in the output so far
-                if (output.size() >= task->terminator.size())
-                {
-                    if (output.find(task->terminator) != std::string::npos)
-                    {
-                        // Found the terminator -> finalize output and stop right away
-                        {
-                            std::lock_guard<std::mutex> lock(g_taskMutex);
-                            task->status = TASK_FINISHED;
-                            task->result = output;  // ensure final result is saved
-                        }
+// Decodes a prompt in chunks, so a first token deadline can expire while a long prompt is being processed
+static LLMPrefillResult prefill_tokens(LLMTask * task, llama_token * tokens, int n_tokens)
+{
+    for (int start = 0; start < n_tokens; start += PREFILL_CHUNK)
+    {
+        if ((task->deadline_first_ms > 0) && (elapsed_ms(task->start_time) > task->deadline_first_ms))
+        {
+            return PREFILL_DEADLINE;
+        }
 
-                        return;         // stop generation immediately
-                    }
-                }
-            }
+        if (!decode_tokens(task->ctx, tokens + start, std::min(PREFILL_CHUNK, n_tokens - start)))
+        {
+            return PREFILL_FAILED;
+        }
+    }
 
-            task->generated_tokens++;
+    return PREFILL_OK;
+}
 
-            // Track history for repetition penalty
-            task->token_history.push_back(token);
-            // Optional: bound history length to avoid unbounded growth
-            if ((int) task->token_history.size() > 1024) {
-                task->token_history.erase(task->token_history.begin(),
-                                          task->token_history.begin() + (task->token_history.size() - 1024));
-            }
+static void finish_prefill_deadline(LLMTask * task)
+{
+    Log("\tDeadline expired before the first token (%.0f ms)!", elapsed_ms(task->start_time));
 
-            // d) feed token back in using llama_batch
-            llama_batch tok_batch = {};
-            tok_batch.n_tokens    = 1;
-            tok_batch.token       = &token;
-            tok_batch.pos         = nullptr;
-            tok_batch.seq_id      = nullptr;
-            tok_batch.n_seq_id    = nullptr;
-            tok_batch.logits      = nullptr;
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+    task->retain_ms = 0;  // prompt is only partly in the KV cache, can't be continued
+    task->flags    |= TASK_FLAG_DEADLINE;
+    task->result.clear();
+    task->status    = TASK_FINISHED;
+}
 
+static llama_token sample_token(LLMTask * task, LLMSamplerType sampler_type, const llama_vocab * vocab, const float * logits)
+{
+    switch (sampler_type)
+    {
+        case SAMPLER_TEMP_TOP_P:
+            return sample_token_temp_top_p(logits, vocab, task);
+        case SAMPLER_GREEDY:
+        default:
+            return sample_token_greedy(logits, vocab, task);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DETOKENIZATION
+// The text of every token in the vocabulary is computed once when the model is loaded, so turning
+// a token into text is just a lookup. Since a UTF-8 character can be split across tokens, the
+// generated text goes through Utf8Stream, which holds incomplete characters back until they are done.
+
+static std::string           g_pieceArena;    // all pieces, back to back
+static std::vector<uint32_t> g_pieceOffsets;  // piece of token t is [offsets[t], offsets[t + 1])
+
+static void build_piece_table(const llama_vocab * vocab)
+{
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+
+    g_pieceArena.clear();
+    g_pieceOffsets.clear();
+    g_pieceOffsets.reserve(n_vocab + 1);
+
+    std::vector<char> buf(512);
+    for (llama_token token = 0; token < n_vocab; ++token)
+    {
+        g_pieceOffsets.push_back((uint32_t) g_pieceArena.size());
+
+        int32_t len = llama_token_to_piece(vocab, token, buf.data(), (int32_t) buf.size(), /* lstrip */ 0, /* special */ true);
+        if (len < 0)
+        {
+            // Buffer too small, len is the size we need
+            buf.resize(-len);
+            len = llama_token_to_piece(vocab, token, buf.data(), (int32_t) buf.size(), /* lstrip */ 0, /* special */ true);
+        }
+        if (len > 0)
+        {
+            g_pieceArena.append(buf.data(), len);
+        }
+    }
+    g_pieceOffsets.push_back((uint32_t) g_pieceArena.size());
+
+    Log("\tPiece table: %i tokens, %i bytes", n_vocab, (int) g_pieceArena.size());
+}
+
+static const char * get_token_piece(llama_token token, int & len)
+{
+    if ((token < 0) || (token + 1 >= (int) g_pieceOffsets.size()))
+    {
+        len = 0;
+        return nullptr;
+    }
+
+    len = (int) (g_pieceOffsets[token + 1] - g_pieceOffsets[token]);
+    return g_pieceArena.data() + g_pieceOffsets[token];
+}
+
+// Number of bytes of the UTF-8 sequence started by this byte (1 for continuation/invalid bytes,
+// which are passed along as they are)
+static int utf8_sequence_length(unsigned char c)
+{
+    if ((c & 0xE0) == 0xC0) return 2;
+    if ((c & 0xF0) == 0xE0) return 3;
+    if ((c & 0xF8) == 0xF0) return 4;
+    return 1;
+}
+
+struct Utf8Stream {
+    std::string pending;
+
+    // Appends the bytes to output, except an incomplete character at the end, which waits for the next call
+    void push(const char * data, int len, std::string & output)
+    {
+        pending.append(data, len);
+
+        // Only the last (up to) 3 bytes can belong to an incomplete character
+        size_t complete = pending.size();
+        for (size_t back = 1; (back <= 3) && (back <= pending.size()); back++)
+        {
+            unsigned char c = (unsigned char) pending[pending.size() - back];
+            if ((c & 0xC0) == 0x80)
+            {
+                continue;  // continuation byte, keep looking for the start
+            }
+
+            if (utf8_sequence_length(c) > (int) back)
+            {
+                complete = pending.size() - back;
+            }
+            break;
+        }
+
+        output.append(pending, 0, complete);
+        pending.erase(0, complete);
+    }
+
+    // End of the text: whatever is left is a broken character
+    void flush(std::string & output)
+    {
+        if (!pending.empty())
+        {
+            output.append("\xEF\xBF\xBD");  // U+FFFD
+            pending.clear();
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PROMPT LOOKUP SPECULATION
+// Stories copy a lot from the prompt (names, events, tags), so the last few tokens generated often
+// appeared before. When they did, whatever followed them is proposed as a draft and the whole
+// draft is verified with a single decode, keeping the tokens the sampler agrees with.
+
+struct NGramIndex {
+    int                               n = 3;
+    std::unordered_map<uint64_t, int> last;  // hash of n tokens -> index of the token that followed them
+
+    static uint64_t key(const llama_token * tokens, int n)
+    {
+        return hash_bytes(14695981039346656037ULL, tokens, n * sizeof(llama_token));
+    }
+
+    // Registers the n-gram that ends right before tokens[index]
+    void add(const std::vector<llama_token> & tokens, int index)
+    {
+        if (index >= n)
+        {
+            last[key(&tokens[index - n], n)] = index;
+        }
+    }
+
+    // Finds where the last n tokens appeared before, returning the index of what followed them (or -1)
+    int find(const std::vector<llama_token> & tokens) const
+    {
+        int size = (int) tokens.size();
+        if (size <= n)
+        {
+            return -1;
+        }
+
+        auto it = last.find(key(&tokens[size - n], n));
+        if (it == last.end())
+        {
+            return -1;
+        }
+
+        // Make sure it's not a hash collision
+        int index = it->second;
+        if (!std::equal(tokens.begin() + (index - n), tokens.begin() + index, tokens.end() - n))
+        {
+            return -1;
+        }
+
+        return index;
+    }
+};
+
+static void build_draft(const std::vector<NGramIndex> & indices, const std::vector<llama_token> & history, int max_draft,
+                        std::vector<llama_token> & draft)
+{
+    draft.clear();
+
+    // Longest n-grams first, they are more likely to be right
+    for (const auto & index : indices)
+    {
+        int start = index.find(history);
+        if (start < 0)
+        {
+            continue;
+        }
+
+        for (int i = start; (i < (int) history.size()) && ((int) draft.size() < max_draft); i++)
+        {
+            draft.push_back(history[i]);
+        }
+        return;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum LLMTokenResult { TOKEN_CONTINUE = 0, TOKEN_END = 1, TOKEN_TERMINATED = 2 };
+
+// Adds a sampled token to the answer, checking for the end of the generation
+static LLMTokenResult accept_token(LLMTask * task, const llama_vocab * vocab, llama_token token, Utf8Stream & utf8, std::string & output)
+{
+    // a) Stop if EOS
+    llama_token eos = llama_vocab_eos(vocab);
+    if (token == eos) {
+        return TOKEN_END;
+    }
+
+    // b) Convert token to text and append
+    int          len   = 0;
+    const char * piece = get_token_piece(token, len);
+
+    if (len > 0)
+    {
 #ifdef LOG_GENERATION
-            Log("\tFeed token %i/%i back...", i, max_new_tokens);
+        Log("\tGenerating token %i/%i...", task->generated_tokens, task->max_tokens);
 #endif
 
-            if (llama_decode(task->ctx, tok_batch) != 0) {
-                task->result = "[ERROR: llama_decode failed during generation]";
-                Log("\t[ERROR: llama_decode failed during generation]");
-                task->status = TASK_ERROR;
-                return;
+        utf8.push(piece, len, output);
+
+        // copy partial output into task->result in a threadsafe way
+        {
+            std::lock_guard<std::mutex> lock(g_taskMutex);
+            task->result = output;
+        }
+    }
+
+    if ((task->terminator_set) && (!task->terminator.empty()))
+    {
+        // Check if the terminator sequence exists in the output so far
+        if (output.size() >= task->terminator.size())
+        {
+            if (output.find(task->terminator) != std::string::npos)
+            {
+                // Found the terminator -> stop right away
+                return TOKEN_TERMINATED;
+            }
+        }
+    }
+
+    task->generated_tokens++;
+
+    // Track history for repetition penalty
+    task->token_history.push_back(token);
+    // Optional: bound history length to avoid unbounded growth
+    if ((int) task->token_history.size() > 1024) {
+        task->token_history.erase(task->token_history.begin(),
+                                  task->token_history.begin() + (task->token_history.size() - 1024));
+    }
+
+    return TOKEN_CONTINUE;
+}
+
+// Runs the generation loop on a context that already has the whole prompt decoded
+static void generate_answer(LLMTask * task)
+{
+    const llama_vocab * vocab = llama_model_get_vocab(g_model);
+
+    std::string output;
+    Utf8Stream  utf8;
+    int         max_new_tokens = task->max_tokens;  // tune this for story length
+
+    const bool has_deadline = (task->deadline_first_ms > 0) || (task->deadline_total_ms > 0);
+    bool       degraded     = false;
+    const bool steer        = (task->deadline_degrade & DEGRADE_STEER) && (task->terminator_set) && (!task->terminator.empty());
+
+    // Degrading only applies to this generation, a continuation starts with the task's own sampler
+    LLMSamplerType sampler_type = task->sampler_type;
+
+    // Everything in the context so far, for prompt lookup
+    std::vector<llama_token> & history = task->context_tokens;
+    std::vector<NGramIndex>    indices;
+    if (task->spec_enabled)
+    {
+        for (int n = task->spec_ngram; n >= std::min(2, task->spec_ngram); n--)
+        {
+            NGramIndex index;
+            index.n = n;
+            for (int i = 0; i < (int) history.size(); i++)
+            {
+                index.add(history, i);
             }
+            indices.push_back(std::move(index));
+        }
+    }
+
+    std::vector<llama_token> batch_tokens;
+    std::vector<llama_token> draft;
+    llama_token              next_token   = 0;
+    bool                     has_next     = false;  // next token already sampled while verifying the draft
+    int                      logits_index = -1;
+    LLMTokenResult           token_result = TOKEN_CONTINUE;
+
+    LLMClock::time_point gen_start = LLMClock::now();
+
+#ifdef LOG_GENERATION
+    Log("\tRunning loop...");
+#endif
+
+    while (task->generated_tokens < max_new_tokens) {
+        const int i = task->generated_tokens;
 
+        // Deadlines
+        if (has_deadline)
+        {
+            double elapsed = elapsed_ms(task->start_time);
+
+            if (((task->deadline_first_ms > 0) && (i == 0) && (elapsed > task->deadline_first_ms)) ||
+                ((task->deadline_total_ms > 0) && (elapsed > task->deadline_total_ms)))
             {
+                Log("\tDeadline expired after %i tokens (%.0f ms)!", i, elapsed);
+
+                record_decode_throughput(i, elapsed_ms(gen_start) / 1000.0);
+
+                utf8.flush(output);
+
+                if ((steer) && (i > 0))
+                {
+                    // Close the answer, the terminator goes into the KV cache if the task is continued
+                    output += task->terminator;
+
+                    std::vector<llama_token> closing = tokenize_prompt(g_model, task->terminator, false);
+                    task->kv_pending.insert(task->kv_pending.end(), closing.begin(), closing.end());
+                }
+
                 std::lock_guard<std::mutex> lock(g_taskMutex);
+                task->flags |= TASK_FLAG_DEADLINE;
+                task->result = output;
+                task->status = TASK_FINISHED;
+                return;
+            }
 
-                if (task->interrupt)
+            if ((task->deadline_total_ms > 0) && (task->deadline_degrade != DEGRADE_NONE))
+            {
+                // Prefer the speed measured on this task, the model estimate is only good until we have some tokens
+                double tps = (i >= 8) ? (i / (elapsed_ms(gen_start) / 1000.0)) : (get_decode_throughput());
+                if (tps > 0.0)
                 {
-                    task->result = output;
-                    task->status = TASK_INTERRUPT;
-                    return;
+                    double time_left = task->deadline_total_ms - elapsed;
+                    double projected = (max_new_tokens - i) * 1000.0 / tps;
+
+                    if ((!degraded) && (projected > time_left))
+                    {
+                        degraded = true;
+                        {
+                            std::lock_guard<std::mutex> lock(g_taskMutex);
+                            task->cacheable = false;
+                            task->flags    |= TASK_FLAG_DEGRADED;
+                        }
+
+                        if (task->deadline_degrade & DEGRADE_GREEDY)
+                        {
+                            sampler_type = SAMPLER_GREEDY;
+                        }
+                        if (task->deadline_degrade & DEGRADE_SHRINK)
+                        {
+                            max_new_tokens = std::max(i + 1, i + (int) (time_left * tps * 0.9 / 1000.0));
+
+                            std::lock_guard<std::mutex> lock(g_taskMutex);
+                            task->max_tokens = max_new_tokens;
+                        }
+
+                        Log("\tDegrading task (%.1f tokens/s, %.0f ms left, new max = %i)", tps, time_left, max_new_tokens);
+                    }
+                }
+            }
+        }
+
+        // a) Sample next token, unless the draft verification already did
+        llama_token token = (has_next) ? (next_token) : (sample_token(task, sampler_type, vocab, llama_get_logits_ith(task->ctx, logits_index)));
+        has_next          = false;
+
+        token_result = accept_token(task, vocab, token, utf8, output);
+        if (token_result != TOKEN_CONTINUE)
+        {
+            if (token_result == TOKEN_TERMINATED)
+            {
+                task->kv_pending.push_back(token);
+            }
+            break;
+        }
+
+        history.push_back(token);
+        for (auto & index : indices)
+        {
+            index.add(history, (int) history.size() - 1);
+        }
+
+        // b) Look for a draft of what comes next
+        draft.clear();
+        if (!indices.empty())
+        {
+            llama_memory_t mem      = llama_get_memory(task->ctx);
+            int            ctx_room = (int) llama_n_ctx(task->ctx) - (llama_memory_seq_pos_max(mem, 0) + 1) - 1;
+            int            budget   = std::min({ task->spec_draft_max, max_new_tokens - task->generated_tokens - 1, ctx_room });
+            if (budget > 0)
+            {
+                build_draft(indices, history, budget, draft);
+            }
+        }
+
+        // c) feed token (and draft) back in using llama_batch
+#ifdef LOG_GENERATION
+        Log("\tFeed token %i/%i back (draft = %i)...", i, max_new_tokens, (int) draft.size());
+#endif
+
+        batch_tokens.assign(1, token);
+        batch_tokens.insert(batch_tokens.end(), draft.begin(), draft.end());
+
+        if (!decode_tokens(task->ctx, batch_tokens.data(), (int) batch_tokens.size(), !draft.empty())) {
+            task->result = "[ERROR: llama_decode failed during generation]";
+            Log("\t[ERROR: llama_decode failed during generation]");
+            task->status = TASK_ERROR;
+            return;
+        }
+
+        logits_index = -1;
+
+        // d) Verify the draft: sample each position and keep going while it matches
+        if (!draft.empty())
+        {
+            int accepted = 0;
+            while (accepted < (int) draft.size())
+            {
+                llama_token sampled = sample_token(task, sampler_type, vocab, llama_get_logits_ith(task->ctx, accepted));
+                if (sampled != draft[accepted])
+                {
+                    next_token = sampled;
+                    has_next   = true;
+                    break;
+                }
+
+                token_result = accept_token(task, vocab, sampled, utf8, output);
+                if (token_result != TOKEN_CONTINUE)
+                {
+                    if (token_result == TOKEN_TERMINATED)
+                    {
+                        task->kv_pending.push_back(sampled);  // rolled back below with the rest of the draft
+                    }
+                    break;
+                }
+
+                accepted++;
+
+                history.push_back(sampled);
+                for (auto & index : indices)
+                {
+                    index.add(history, (int) history.size() - 1);
                 }
             }
+
+            task->spec_drafted  += (int) draft.size();
+            task->spec_accepted += accepted;
+
+            // Drop the rejected part of the draft from the context
+            if (accepted < (int) draft.size())
+            {
+                llama_memory_t mem = llama_get_memory(task->ctx);
+                llama_pos      end = llama_memory_seq_pos_max(mem, 0) + 1;
+                llama_memory_seq_rm(mem, 0, end - ((int) draft.size() - accepted), -1);
+            }
+
+            logits_index = accepted;
+
+            if (token_result != TOKEN_CONTINUE)
+            {
+                break;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(g_taskMutex);
+
+            if (task->interrupt)
+            {
+                task->result = output;
+                task->status = TASK_INTERRUPT;
+                return;
+            }
         }
+    }
+
+    record_decode_throughput(task->generated_tokens, elapsed_ms(gen_start) / 1000.0);
+
+    utf8.flush(output);
 
-        task->result = output;
+    if (task->spec_drafted > 0)
+    {
+        Log("\tSpeculation: accepted %i of %i drafted tokens", task->spec_accepted, task->spec_drafted);
+    }
+
+    if (task->cacheable)
+    {
+        cache_store(task->cache_key, output, task->generated_tokens);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_taskMutex);
+        task->result = output;  // ensure final result is saved
         task->status = TASK_FINISHED;
+    }
+
+    Log("\tGeneration complete!");
+}
+
+// Continues a retained task: the context still holds the previous prompt and answer, so only the
+// new text has to be decoded
+static void run_continuation(LLMTask * task)
+{
+    Log("Continuing task %i...", task->id);
+
+    std::vector<llama_token> tokens = task->kv_pending;
+    std::vector<llama_token> extra  = tokenize_prompt(g_model, task->prompt, false);
+    tokens.insert(tokens.end(), extra.begin(), extra.end());
+    task->kv_pending.clear();
+
+    llama_memory_t mem = llama_get_memory(task->ctx);
+    if ((tokens.empty()) && (!task->context_tokens.empty()))
+    {
+        // Nothing new, so redo the last token to get fresh logits
+        llama_memory_seq_rm(mem, 0, (llama_pos) task->context_tokens.size() - 1, -1);
+        tokens.push_back(task->context_tokens.back());
+        task->context_tokens.pop_back();
+    }
+
+    int room = (int) llama_n_ctx(task->ctx) - (int) task->context_tokens.size() - (int) tokens.size();
+    if ((tokens.empty()) || (room <= 0))
+    {
+        task->result = "[ERROR: no room in context to continue]";
+        Log("\t[ERROR: no room in context to continue]");
+        task->status = TASK_ERROR;
+        return;
+    }
+
+    if (task->max_tokens > room)
+    {
+        std::lock_guard<std::mutex> lock(g_taskMutex);
+        task->max_tokens = room;
+    }
+
+    try
+    {
+        LLMClock::time_point prefill_start = LLMClock::now();
+
+        LLMPrefillResult prefill = prefill_tokens(task, tokens.data(), (int) tokens.size());
+        if (prefill == PREFILL_FAILED) {
+            task->result = "[ERROR: llama_decode failed for prompt]";
+            Log("\t[ERROR: llama_decode failed for prompt]");
+            task->status = TASK_ERROR;
+            return;
+        }
+        if (prefill == PREFILL_DEADLINE) {
+            finish_prefill_deadline(task);
+            return;
+        }
+
+        record_prefill_throughput((int) tokens.size(), elapsed_ms(prefill_start) / 1000.0);
 
-        Log("\tGeneration complete!");
+        task->context_tokens.insert(task->context_tokens.end(), tokens.begin(), tokens.end());
 
+        // The sampler keeps its random state, so seeded continuations are reproducible too
+        generate_answer(task);
     }
     catch (...)
     {
         Log("\t[EXCEPTION: generation crashed]");
 
-        task->result = "[EXCEPTION: generation crashed]";
-        task->status = TASK_ERROR;
+        task->result = "[EXCEPTION: generation crashed]";
+        task->status = TASK_ERROR;
+    }
+}
+
+// Status is already TASK_RUNNING, set by llm_start
+static void run_task(LLMTask * task)
+{
+    Log("Running gen task...");
+
+    if (!g_model) {
+        task->result = "[ERROR: model not initialized]";
+        Log("\nModel not initialized!");
+        task->status = TASK_ERROR;
+        return;
+    }
+
+    if (task->continuation)
+    {
+        run_continuation(task);
+        return;
+    }
+
+    // Deterministic tasks can be answered from the cache, no need for a context
+    std::vector<llama_token> prompt_tokens = tokenize_prompt(g_model, task->prompt);
+    if (prompt_tokens.empty()) {
+        task->result = "[ERROR: failed to tokenize prompt]";
+        Log("\t[ERROR: failed to tokenize prompt]");
+        task->status = TASK_ERROR;
+        return;
+    }
+
+    task->rng.seed(task->seed_set ? task->seed : std::random_device{}());
+
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        task->cacheable = g_cacheEnabled && ((task->sampler_type == SAMPLER_GREEDY) || (task->seed_set));
+    }
+
+    if (task->cacheable)
+    {
+        task->cache_key = compute_cache_key(task, prompt_tokens);
+
+        LLMCacheEntry entry;
+        if (cache_lookup(task->cache_key, entry))
+        {
+            Log("\tAnswer found in cache!");
+
+            std::lock_guard<std::mutex> lock(g_taskMutex);
+            task->result           = entry.result;
+            task->generated_tokens = entry.generated_tokens;
+            task->flags           |= TASK_FLAG_CACHED;
+            task->status           = TASK_FINISHED;
+            return;
+        }
+    }
+
+    if (!create_task_context(task, get_thread_count()))
+    {
+        return;
+    }
+
+    try
+    {
+        // ----------------------------------
+        // 1. Decode prompt
+        // ----------------------------------
+#ifdef LOG_GENERATION
+        Log("\tBuilding batch for prompt...");
+#endif
+
+        LLMClock::time_point prefill_start = LLMClock::now();
+
+        LLMPrefillResult prefill = prefill_tokens(task, prompt_tokens.data(), (int) prompt_tokens.size());
+        if (prefill == PREFILL_FAILED) {
+            task->result = "[ERROR: llama_decode failed for prompt]";
+            Log("\t[ERROR: llama_decode failed for prompt]");
+            task->status = TASK_ERROR;
+            return;
+        }
+        if (prefill == PREFILL_DEADLINE) {
+            finish_prefill_deadline(task);
+            return;
+        }
+
+        record_prefill_throughput((int) prompt_tokens.size(), elapsed_ms(prefill_start) / 1000.0);
+
+        // ----------------------------------
+        // 2. Generation loop
+        // ----------------------------------
+        task->context_tokens = std::move(prompt_tokens);
+
+        generate_answer(task);
+    }
+    catch (...)
+    {
+        Log("\t[EXCEPTION: generation crashed]");
+
+        task->result = "[EXCEPTION: generation crashed]";
+        task->status = TASK_ERROR;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SESSIONS
+// A session is a task whose prompt arrives in pieces (e.g. a life event at a time). The worker
+// prefills each piece in the background with few threads, so by the time the suffix arrives
+// only that suffix needs decoding before generation starts.
+// Each piece is tokenized on its own, so the tokens (and the cache key) of a session are always the
+// same for the same appends, but can differ from the same prompt sent whole to llm_query.
+
+static const int SESSION_PREFILL_CHUNK = 32;
+
+static void finish_session_worker(LLMTask * task)
+{
+    // Called with g_taskMutex held, the task can't be touched after this
+    if (task->session_discard)
+    {
+        auto it = g_tasks.find(task->id);
+        if (it != g_tasks.end())
+        {
+            it->second->clear();
+            g_tasks.erase(it);
+        }
+    }
+    else if (task->interrupt)
+    {
+        task->status = TASK_INTERRUPT;
+    }
+}
+
+static void run_session(LLMTask * task)
+{
+    Log("Running session %i...", task->id);
+
+    if (!g_model) {
+        std::lock_guard<std::mutex> lock(g_taskMutex);
+        task->result = "[ERROR: model not initialized]";
+        Log("\nModel not initialized!");
+        task->status = TASK_ERROR;
+        g_sessionWorkers--;
+        return;
+    }
+
+    const unsigned hw = get_thread_count();
+    if (!create_task_context(task, hw))
+    {
+        g_sessionWorkers--;
+        return;
+    }
+
+    // Background prefill shouldn't compete with the game for the CPU
+    const unsigned background_threads = std::max(1u, hw / 4);
+    llama_set_n_threads(task->ctx, background_threads, background_threads);
+
+    try
+    {
+        std::vector<llama_token> pending_tokens;
+        size_t                   pending_start = 0;
+        bool                     first_piece   = true;
+        bool                     generate      = false;
+
+        while (true)
+        {
+            std::vector<std::string> pieces;
+            {
+                std::unique_lock<std::mutex> lock(g_taskMutex);
+
+                if (pending_start >= pending_tokens.size())
+                {
+                    task->session_cv.wait(lock, [task]() {
+                        return task->interrupt || task->session_generate || !task->session_pending.empty();
+                    });
+                }
+
+                if (task->interrupt)
+                {
+                    Log("\tSession %i interrupted!", task->id);
+                    finish_session_worker(task);
+                    g_sessionWorkers--;
+                    return;
+                }
+
+                pieces.swap(task->session_pending);
+
+                if ((task->session_generate) && (!generate))
+                {
+                    generate         = true;
+                    task->status     = TASK_RUNNING;
+                    task->start_time = LLMClock::now();
+                }
+            }
+
+            // One piece at a time, so the tokens only depend on the appends and not on how many
+            // of them arrived while we were busy
+            for (const std::string & text : pieces)
+            {
+                if (!text.empty())
+                {
+                    std::vector<llama_token> tokens = tokenize_prompt(g_model, text, first_piece);
+                    pending_tokens.insert(pending_tokens.end(), tokens.begin(), tokens.end());
+                    first_piece = false;
+                }
+            }
+
+            if (generate)
+            {
+                if (pending_tokens.empty())
+                {
+                    std::lock_guard<std::mutex> lock(g_taskMutex);
+                    task->result = "[ERROR: failed to tokenize prompt]";
+                    Log("\t[ERROR: failed to tokenize prompt]");
+                    task->status = TASK_ERROR;
+                    g_sessionWorkers--;
+                    return;
+                }
+
+                // Whole prompt is known now, so deterministic sessions can be answered from the cache
+                {
+                    std::lock_guard<std::mutex> lock(g_cacheMutex);
+                    task->cacheable = g_cacheEnabled && ((task->sampler_type == SAMPLER_GREEDY) || (task->seed_set));
+                }
+
+                if (task->cacheable)
+                {
+                    task->cache_key = compute_cache_key(task, pending_tokens);
+
+                    LLMCacheEntry entry;
+                    if (cache_lookup(task->cache_key, entry))
+                    {
+                        Log("\tAnswer found in cache!");
+
+                        std::lock_guard<std::mutex> lock(g_taskMutex);
+                        task->result           = entry.result;
+                        task->generated_tokens = entry.generated_tokens;
+                        task->flags           |= TASK_FLAG_CACHED;
+                        task->status           = TASK_FINISHED;
+                        task->retain_ms        = 0;  // KV doesn't hold the answer, can't be continued
+                        g_sessionWorkers--;
+                        return;
+                    }
+                }
+
+                // Everything we still have is on the critical path now, so go full speed
+                llama_set_n_threads(task->ctx, hw, hw);
+
+                LLMPrefillResult prefill = prefill_tokens(task, pending_tokens.data() + pending_start, (int) (pending_tokens.size() - pending_start));
+                if (prefill == PREFILL_FAILED)
+                {
+                    std::lock_guard<std::mutex> lock(g_taskMutex);
+                    task->result = "[ERROR: llama_decode failed for prompt]";
+                    Log("\t[ERROR: llama_decode failed for prompt]");
+                    task->status = TASK_ERROR;
+                    g_sessionWorkers--;
+                    return;
+                }
+                if (prefill == PREFILL_DEADLINE)
+                {
+                    finish_prefill_deadline(task);
+                    g_sessionWorkers--;
+                    return;
+                }
+                break;
+            }
+
+            if (pending_start < pending_tokens.size())
+            {
+                int n_tokens = std::min(SESSION_PREFILL_CHUNK, (int) (pending_tokens.size() - pending_start));
+                if (!decode_tokens(task->ctx, pending_tokens.data() + pending_start, n_tokens))
+                {
+                    std::lock_guard<std::mutex> lock(g_taskMutex);
+                    task->result = "[ERROR: llama_decode failed for prompt]";
+                    Log("\t[ERROR: llama_decode failed for prompt]");
+                    task->status = TASK_ERROR;
+                    g_sessionWorkers--;
+                    return;
+                }
+                pending_start += n_tokens;
+            }
+        }
+
+        Log("\tSession %i prefilled %i tokens, generating...", task->id, (int) pending_tokens.size());
+
+        task->rng.seed(task->seed_set ? task->seed : std::random_device{}());
+
+        task->context_tokens = std::move(pending_tokens);
+
+        generate_answer(task);
+    }
+    catch (...)
+    {
+        Log("\t[EXCEPTION: generation crashed]");
+
+        task->result = "[EXCEPTION: generation crashed]";
+        task->status = TASK_ERROR;
+    }
+
+    g_sessionWorkers--;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// HOST CLIENT
+// After llm_connect_host, the C API forwards everything to llm_host, a separate process that owns the
+// model, so it stays loaded when the game (or the editor) restarts and can be shared between
+// processes. Answers are read from shared memory (see llm_ipc.h), so polling doesn't use the pipe.
+
+struct LLMRemoteStream {
+    int         slot     = -1;
+    uint64_t    base     = 0;
+    uint64_t    read_pos = 0;
+    bool        polled   = false;
+    std::string text;
+};
+
+static std::atomic<bool>                        g_remote{ false };
+static std::mutex                               g_remotePipeMutex;  // one request/response at a time
+static HANDLE                                   g_remotePipe    = INVALID_HANDLE_VALUE;
+static HANDLE                                   g_remoteMapping = nullptr;
+static LLMIpcShared *                           g_remoteShared  = nullptr;
+static std::mutex                               g_remoteMutex;      // guards the streams
+static std::unordered_map<int, LLMRemoteStream> g_remoteStreams;
+
+static bool remote_request(int op, std::initializer_list<int> ints, std::initializer_list<float> floats, const char * text,
+                           LLMIpcResponse & response, std::string * response_text = nullptr)
+{
+    LLMIpcRequest request = {};
+    request.op            = op;
+    request.text_len      = (text) ? ((uint32_t) strlen(text)) : (0);
+
+    int index = 0;
+    for (int value : ints)
+    {
+        request.ints[index++] = value;
+    }
+    index = 0;
+    for (float value : floats)
+    {
+        request.floats[index++] = value;
+    }
+
+    std::lock_guard<std::mutex> lock(g_remotePipeMutex);
+
+    if (g_remotePipe == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    response = {};
+    if ((!ipc_pipe_write(g_remotePipe, &request, sizeof(request))) ||
+        ((request.text_len > 0) && (!ipc_pipe_write(g_remotePipe, text, request.text_len))) ||
+        (!ipc_pipe_read(g_remotePipe, &response, sizeof(response))) ||
+        (response.text_len > LLM_IPC_MAX_TEXT))
+    {
+        Log("Lost connection to host (op = %i)!", op);
+        return false;
+    }
+
+    std::string received(response.text_len, '\0');
+    if ((response.text_len > 0) && (!ipc_pipe_read(g_remotePipe, &received[0], response.text_len)))
+    {
+        Log("Lost connection to host (op = %i)!", op);
+        return false;
+    }
+
+    if (response_text)
+    {
+        response_text->swap(received);
+    }
+
+    return true;
+}
+
+static int remote_call(int op, int fail_value, std::initializer_list<int> ints = {}, std::initializer_list<float> floats = {},
+                       const char * text = nullptr)
+{
+    LLMIpcResponse response;
+    if (!remote_request(op, ints, floats, text, response))
+    {
+        return fail_value;
+    }
+    return response.ret;
+}
+
+// Calls that create a task on the host also get a slot to stream its answer (or -1 if none is free)
+static int remote_create_task(int op, std::initializer_list<int> ints, const char * text, std::initializer_list<float> floats = {})
+{
+    LLMIpcResponse response;
+    if ((!remote_request(op, ints, floats, text, response)) || (response.ret < 0))
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(g_remoteMutex);
+
+    LLMRemoteStream & stream = g_remoteStreams[response.ret];
+    stream.slot              = response.ints[0];
+    stream.text.clear();
+    if ((stream.slot >= 0) && (stream.slot < LLM_IPC_SLOTS))
+    {
+        stream.base     = g_remoteShared->slots[stream.slot].base.load();
+        stream.read_pos = stream.base;
+    }
+    else
+    {
+        stream.slot = -1;
+    }
+
+    return response.ret;
+}
+
+static void copy_answer(const std::string & text, char * buffer, int buffer_size)
+{
+    if ((buffer) && (buffer_size > 0))
+    {
+        int len = (int) text.size();
+        if (len >= buffer_size) {
+            len = buffer_size - 1;
+
+            // Don't cut a UTF-8 character in half
+            while ((len > 0) && (((unsigned char) text[len] & 0xC0) == 0x80)) {
+                len--;
+            }
+        }
+        std::memcpy(buffer, text.data(), len);
+        buffer[len] = '\0';
+    }
+}
+
+static int remote_get_answer(int query_id, char * buffer, int buffer_size, int * out_generated_tokens, int * out_max_tokens, int * out_flags)
+{
+    std::unique_lock<std::mutex> lock(g_remoteMutex);
+
+    auto it = g_remoteStreams.find(query_id);
+    if ((it == g_remoteStreams.end()) || (it->second.slot < 0))
+    {
+        lock.unlock();
+
+        // No slot for this one, ask the host
+        LLMIpcResponse response;
+        std::string    text;
+        if (!remote_request(LLM_OP_GET_ANSWER, { query_id, buffer_size }, {}, nullptr, response, &text))
+        {
+            copy_answer("[ERROR: lost connection to host]", buffer, buffer_size);
+            return TASK_ERROR;
+        }
+
+        copy_answer(text, buffer, buffer_size);
+        if (out_generated_tokens) *out_generated_tokens = response.ints[0];
+        if (out_max_tokens) *out_max_tokens = response.ints[1];
+        if (out_flags) *out_flags = response.ints[2];
+
+        if (is_final_status(response.ret))
+        {
+            lock.lock();
+            g_remoteStreams.erase(query_id);
+        }
+
+        return response.ret;
+    }
+
+    LLMRemoteStream & stream = it->second;
+    LLMIpcSlot &      slot   = g_remoteShared->slots[stream.slot];
+    stream.polled            = true;
+
+    // Status first: if it's final, all the text is already written
+    int status = slot.status.load();
+
+    uint64_t base;
+    do
+    {
+        base = slot.base.load();
+        if (base != stream.base)
+        {
+            // Text was replaced, start over
+            stream.base     = base;
+            stream.read_pos = base;
+            stream.text.clear();
+        }
+
+        uint64_t write_pos = slot.write_pos.load();
+        while (stream.read_pos < write_pos)
+        {
+            uint32_t offset = (uint32_t) (stream.read_pos % LLM_IPC_RING_SIZE);
+            uint32_t count  = (uint32_t) std::min<uint64_t>(write_pos - stream.read_pos, LLM_IPC_RING_SIZE - offset);
+            stream.text.append(slot.ring + offset, count);
+            stream.read_pos += count;
+        }
+    } while (slot.base.load() != base);
+
+    slot.read_pos.store(stream.read_pos);
+
+    copy_answer(stream.text, buffer, buffer_size);
+    if (out_generated_tokens) *out_generated_tokens = slot.generated_tokens.load();
+    if (out_max_tokens) *out_max_tokens = slot.max_tokens.load();
+    if (out_flags) *out_flags = slot.flags.load();
+
+    if (is_final_status(status))
+    {
+        int slot_index = stream.slot;
+        g_remoteStreams.erase(it);
+        lock.unlock();
+
+        remote_call(LLM_OP_RELEASE_SLOT, 0, { slot_index });
+    }
+
+    return status;
+}
+
+// The caller won't read the task's answer, so its slot can go back to the host (only_unpolled: only
+// if it was never read, as after llm_stop the caller may still want the partial answer)
+static void remote_release_stream(int query_id, bool only_unpolled)
+{
+    int slot_index = -1;
+    {
+        std::lock_guard<std::mutex> lock(g_remoteMutex);
+
+        auto it = g_remoteStreams.find(query_id);
+        if ((it == g_remoteStreams.end()) || ((only_unpolled) && (it->second.polled)))
+        {
+            return;
+        }
+
+        slot_index = it->second.slot;
+        g_remoteStreams.erase(it);
+    }
+
+    if (slot_index >= 0)
+    {
+        remote_call(LLM_OP_RELEASE_SLOT, 0, { slot_index });
+    }
+}
+
+static void remote_disconnect()
+{
+    if (!g_remote)
+    {
+        return;
+    }
+
+    Log("Disconnecting from host...");
+
+    remote_call(LLM_OP_SHUTDOWN, 0);
+
+    g_remote = false;
+
+    {
+        std::lock_guard<std::mutex> lock(g_remotePipeMutex);
+        if (g_remotePipe != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(g_remotePipe);
+            g_remotePipe = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(g_remoteMutex);
+    g_remoteStreams.clear();
+    if (g_remoteShared)
+    {
+        UnmapViewOfFile(g_remoteShared);
+        g_remoteShared = nullptr;
+    }
+    if (g_remoteMapping)
+    {
+        CloseHandle(g_remoteMapping);
+        g_remoteMapping = nullptr;
+    }
+}
+
+static HANDLE open_host_pipe(const std::string & pipe_path, const char * host_path)
+{
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        HANDLE pipe = CreateFileA(pipe_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE)
+        {
+            return pipe;
+        }
+
+        if (GetLastError() == ERROR_PIPE_BUSY)
+        {
+            WaitNamedPipeA(pipe_path.c_str(), 100);
+            continue;
+        }
+
+        if ((attempt == 0) && (host_path) && (host_path[0] != '\0'))
+        {
+            // Nobody listening, start the host ourselves; it outlives this process
+            Log("\tStarting host %s...", host_path);
+
+            std::string         command = std::string("\"") + host_path + "\" --pipe " + pipe_path.substr(9);
+            STARTUPINFOA        startup = {};
+            PROCESS_INFORMATION process = {};
+            startup.cb                  = sizeof(startup);
+
+            if (!CreateProcessA(host_path, &command[0], nullptr, nullptr, FALSE, CREATE_NO_WINDOW | CREATE_NEW_PROCESS_GROUP,
+                                nullptr, nullptr, &startup, &process))
+            {
+                Log("\tFailed to start host!");
+                return INVALID_HANDLE_VALUE;
+            }
+            CloseHandle(process.hThread);
+            CloseHandle(process.hProcess);
+        }
+        else if ((!host_path) || (host_path[0] == '\0'))
+        {
+            return INVALID_HANDLE_VALUE;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+
+    return INVALID_HANDLE_VALUE;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -542,6 +2091,11 @@ static void run_task(LLMTask * task)
 extern "C" {
 
 __declspec(dllexport) int llm_init(const char * model_path, int gpu_layers, int context_size) {
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_INIT, LLM_INIT_ERROR, { gpu_layers, context_size }, {}, model_path);
+    }
+
     std::lock_guard<std::mutex> lock(g_llmMutex);
 
     if (g_model)
@@ -602,17 +2156,124 @@ __declspec(dllexport) int llm_init(const char * model_path, int gpu_layers, int
 
     g_ContextSize = context_size;
 
+    build_piece_table(llama_model_get_vocab(g_model));
+
+    {
+        std::lock_guard<std::mutex> lock(g_throughputMutex);
+        g_throughput = LLMThroughput();
+    }
+
+    // Identifies the model for the response cache
+    char desc[256];
+    llama_model_desc(g_model, desc, sizeof(desc));
+    g_modelId = std::string(model_path) + "|" + desc + "|" + std::to_string(llama_model_size(g_model));
+
+    return LLM_INIT_OK;
+}
+
+// Loads a LoRA adapter for the current model, returning its handle (or -1 on failure).
+// Loading the same file again returns the existing handle.
+__declspec(dllexport) int llm_load_adapter(const char * path)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_LOAD_ADAPTER, -1, {}, {}, path);
+    }
+
+    std::lock_guard<std::mutex> lock(g_llmMutex);
+
+    if ((!g_model) || (path == nullptr) || (path[0] == '\0'))
+    {
+        return -1;
+    }
+
+    for (auto & kv : g_adapters)
+    {
+        if (kv.second.path == path)
+        {
+            return kv.first;
+        }
+    }
+
+    Log("Loading adapter %s...", path);
+
+    if (!std::filesystem::exists(path))
+    {
+        Log("\tAdapter file not found!");
+        return -1;
+    }
+
+    llama_adapter_lora * adapter = llama_adapter_lora_init(g_model, path);
+    if (!adapter)
+    {
+        Log("\tFailed to load adapter!");
+        return -1;
+    }
+
+    int id = g_nextAdapterId++;
+
+    g_adapters[id] = { path, adapter };
+
+    return id;
+}
+
+__declspec(dllexport) int llm_unload_adapter(int adapter_id)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_UNLOAD_ADAPTER, LLM_INIT_ERROR, { adapter_id });
+    }
+
+    std::lock_guard<std::mutex> lock(g_llmMutex);
+
+    auto it = g_adapters.find(adapter_id);
+    if (it == g_adapters.end())
+    {
+        return LLM_INIT_ERROR;
+    }
+
+    {
+        // Contexts using it must be gone first
+        std::lock_guard<std::mutex> taskLock(g_taskMutex);
+        for (auto & kv : g_tasks)
+        {
+            if (kv.second->adapter_id == adapter_id)
+            {
+                Log("Can't unload adapter %i, task %i is using it!", adapter_id, kv.first);
+                return LLM_INIT_ERROR;
+            }
+        }
+        for (auto & kv : g_retained)
+        {
+            if (kv.second->adapter_id == adapter_id)
+            {
+                Log("Can't unload adapter %i, retained task %i is using it!", adapter_id, kv.first);
+                return LLM_INIT_ERROR;
+            }
+        }
+    }
+
+    llama_adapter_lora_free(it->second.adapter);
+    g_adapters.erase(it);
+
     return LLM_INIT_OK;
 }
 
 __declspec(dllexport) int llm_query(const char * prompt, int maxTokens)
 {
+    if ((g_remote) && (prompt))
+    {
+        return remote_create_task(LLM_OP_QUERY, { maxTokens }, prompt);
+    }
+
     if (!prompt)
     {
         Log("Query failed, no prompt provided!");
         return -1;
     }
 
+    evict_retained(false);
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
     int id = g_nextId++;
@@ -635,6 +2296,11 @@ __declspec(dllexport) int llm_query(const char * prompt, int maxTokens)
 
 __declspec(dllexport) int llm_set_termination_token(int query_id, const char *terminator)
 {
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_TERMINATION_TOKEN, TASK_ERROR, { query_id }, {}, (terminator) ? (terminator) : (""));
+    }
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
     auto it = g_tasks.find(query_id);
@@ -653,6 +2319,12 @@ __declspec(dllexport) int llm_set_termination_token(int query_id, const char *te
 }
 
 __declspec(dllexport) int llm_set_sampler_improved(int query_id, float temperature, float top_p, bool enableRepetionPenalty, float repetionPenalty, int repetitionWindow) {
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_SAMPLER_IMPROVED, TASK_ERROR, { query_id, enableRepetionPenalty, repetitionWindow },
+                           { temperature, top_p, repetionPenalty });
+    }
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
     auto it = g_tasks.find(query_id);
@@ -673,17 +2345,307 @@ __declspec(dllexport) int llm_set_sampler_improved(int query_id, float temperatu
         top_p = 1.0f;
     }
 
-    task->sampler_type = SAMPLER_TEMP_TOP_P;
-    task->temperature  = temperature;
-    task->top_p        = top_p;
-    task->use_repetition_penalty = enableRepetionPenalty;
-    task->repetition_penalty     = repetionPenalty;
-    task->repetition_window  = repetitionWindow;
+    task->sampler_type = SAMPLER_TEMP_TOP_P;
+    task->temperature  = temperature;
+    task->top_p        = top_p;
+    task->use_repetition_penalty = enableRepetionPenalty;
+    task->repetition_penalty     = repetionPenalty;
+    task->repetition_window  = repetitionWindow;
+
+    return TASK_QUEUED;  // or some neutral status; mainly you just need "success"
+}
+
+__declspec(dllexport) int llm_set_seed(int query_id, unsigned int seed)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_SEED, TASK_ERROR, { query_id, (int) seed });
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end()) {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if (task->status == TASK_QUEUED)
+    {
+        task->seed     = seed;
+        task->seed_set = true;
+    }
+
+    return task->status;
+}
+
+// Time budget for a task: ms until the first token and ms for the whole answer (0 = no limit).
+// When it expires the task finishes with what it has, flagged with TASK_FLAG_DEADLINE.
+__declspec(dllexport) int llm_set_deadline(int query_id, int ms_first_token, int ms_total)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_DEADLINE, TASK_ERROR, { query_id, ms_first_token, ms_total });
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end()) {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if (task->status == TASK_QUEUED)
+    {
+        task->deadline_first_ms = std::max(0, ms_first_token);
+        task->deadline_total_ms = std::max(0, ms_total);
+    }
+
+    return task->status;
+}
+
+// Combination of LLMDeadlineDegrade flags, applied once the task is projected to miss the total deadline
+__declspec(dllexport) int llm_set_deadline_degrade(int query_id, int degrade_flags)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_DEADLINE_DEGRADE, TASK_ERROR, { query_id, degrade_flags });
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end()) {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if (task->status == TASK_QUEUED)
+    {
+        task->deadline_degrade = degrade_flags;
+    }
+
+    return task->status;
+}
+
+__declspec(dllexport) void llm_get_throughput(float * out_decode_tps, float * out_prefill_tps)
+{
+    if (g_remote)
+    {
+        LLMIpcResponse response;
+        if (remote_request(LLM_OP_GET_THROUGHPUT, {}, {}, nullptr, response))
+        {
+            if (out_decode_tps) *out_decode_tps = response.floats[0];
+            if (out_prefill_tps) *out_prefill_tps = response.floats[1];
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_throughputMutex);
+
+    if (out_decode_tps)
+    {
+        *out_decode_tps = (float) g_throughput.decode_tps;
+    }
+    if (out_prefill_tps)
+    {
+        *out_prefill_tps = (float) g_throughput.prefill_tps;
+    }
+}
+
+// Keeps the task's context alive for ttl_ms after it finishes, so it can be extended with llm_continue
+__declspec(dllexport) int llm_set_retain(int query_id, int ttl_ms)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_RETAIN, TASK_ERROR, { query_id, ttl_ms });
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end()) {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task  = it->second.get();
+    task->retain_ms = std::max(0, ttl_ms);
+
+    return task->status;
+}
+
+// Max number of retained contexts (each one holds a full KV cache), 0 disables retention
+__declspec(dllexport) void llm_set_retain_limit(int max_contexts)
+{
+    if (g_remote)
+    {
+        remote_call(LLM_OP_SET_RETAIN_LIMIT, 0, { max_contexts });
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    g_retainMaxContexts = std::max(0, max_contexts);
+    trim_retained(g_retainMaxContexts);
+}
+
+// Queues a follow-up generation on a retained task, with extra_prompt appended after its answer.
+// Returns the id to start and poll (the same one), or -1 if the task isn't retained (anymore).
+__declspec(dllexport) int llm_continue(int query_id, const char * extra_prompt, int max_tokens)
+{
+    if (g_remote)
+    {
+        return remote_create_task(LLM_OP_CONTINUE, { query_id, max_tokens }, (extra_prompt) ? (extra_prompt) : (""));
+    }
+
+    evict_retained(false);
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_retained.find(query_id);
+    if ((it == g_retained.end()) || (g_tasks.find(query_id) != g_tasks.end()))
+    {
+        Log("Task %i can't be continued!", query_id);
+        return -1;
+    }
+
+    std::unique_ptr<LLMTask> task = std::move(it->second);
+    g_retained.erase(it);
+
+    task->prompt           = (extra_prompt) ? (extra_prompt) : ("");
+    task->result.clear();
+    task->status           = TASK_QUEUED;
+    task->max_tokens       = max_tokens;
+    task->generated_tokens = 0;
+    task->interrupt        = false;
+    task->session          = false;
+    task->continuation     = true;
+    task->cacheable        = false;
+    task->flags            = TASK_FLAG_NONE;
+    task->spec_drafted     = 0;
+    task->spec_accepted    = 0;
+
+    g_tasks[query_id] = std::move(task);
+
+    Log("Task %i continued!", query_id);
+
+    return query_id;
+}
+
+// Enables prompt lookup speculation: drafts of up to max_draft tokens are proposed by finding the
+// last ngram_size (down to 2) tokens earlier in the prompt/answer, and verified with a single decode
+__declspec(dllexport) int llm_set_speculation(int query_id, bool enable, int ngram_size, int max_draft)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_SPECULATION, TASK_ERROR, { query_id, enable, ngram_size, max_draft });
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end()) {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if (task->status == TASK_QUEUED)
+    {
+        task->spec_enabled   = enable;
+        task->spec_ngram     = std::max(1, ngram_size);
+        task->spec_draft_max = std::max(1, max_draft);
+    }
+
+    return task->status;
+}
+
+// Still works after llm_get_answer returned the final status, for the last SPEC_STATS_KEEP tasks
+__declspec(dllexport) int llm_get_speculation_stats(int query_id, int * out_drafted, int * out_accepted)
+{
+    if (g_remote)
+    {
+        LLMIpcResponse response;
+        if (!remote_request(LLM_OP_GET_SPECULATION_STATS, { query_id }, {}, nullptr, response))
+        {
+            return TASK_ERROR;
+        }
+        if (out_drafted) *out_drafted = response.ints[0];
+        if (out_accepted) *out_accepted = response.ints[1];
+        return response.ret;
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    LLMTask * task = nullptr;
+
+    auto it = g_tasks.find(query_id);
+    if (it != g_tasks.end())
+    {
+        task = it->second.get();
+    }
+    else
+    {
+        auto retained = g_retained.find(query_id);
+        if (retained != g_retained.end())
+        {
+            task = retained->second.get();
+        }
+    }
+
+    if (task)
+    {
+        if (out_drafted) *out_drafted = task->spec_drafted;
+        if (out_accepted) *out_accepted = task->spec_accepted;
+        return task->status;
+    }
+
+    // Answer already read, the final counts were kept
+    auto stats = g_specStats.find(query_id);
+    if (stats == g_specStats.end())
+    {
+        return TASK_INVALID_ID;
+    }
+
+    if (out_drafted) *out_drafted = stats->second.first;
+    if (out_accepted) *out_accepted = stats->second.second;
+
+    return TASK_FINISHED;
+}
+
+// Selects the LoRA adapter for a query (0 = none). Sessions create their context when they begin,
+// so for those the adapter is given to llm_session_begin_ex instead. Continuations keep the context
+// (and adapter) of the task they continue.
+__declspec(dllexport) int llm_set_adapter(int query_id, int adapter_id, float scale)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_ADAPTER, TASK_ERROR, { query_id, adapter_id }, { scale });
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end()) {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if ((task->status == TASK_QUEUED) && (!task->session) && (!task->continuation) && (!task->ctx))
+    {
+        task->adapter_id    = adapter_id;
+        task->adapter_scale = scale;
+    }
 
-    return TASK_QUEUED;  // or some neutral status; mainly you just need "success"
+    return task->status;
 }
 
 __declspec(dllexport) int llm_set_sampler_greedy(int query_id) {
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SET_SAMPLER_GREEDY, TASK_ERROR, { query_id });
+    }
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
     auto it = g_tasks.find(query_id);
@@ -699,6 +2661,11 @@ __declspec(dllexport) int llm_set_sampler_greedy(int query_id) {
 
 __declspec(dllexport) int llm_start(int query_id)
 {
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_START, TASK_ERROR, { query_id });
+    }
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
     Log("Starting task %i!", query_id);
@@ -711,10 +2678,20 @@ __declspec(dllexport) int llm_start(int query_id)
     }
 
     LLMTask * task  = it->second.get();
+    if (task->session)
+    {
+        Log("\tSessions are started by llm_session_generate!");
+        return task->status;
+    }
+
     if (task->status == TASK_QUEUED)
     {
         Log("\tStarting thread!");
 
+        // Set here, under the lock, so llm_stop can't take it for a task that never started
+        task->status     = TASK_RUNNING;
+        task->start_time = LLMClock::now();
+
         task->worker = std::thread([task]() { run_task(task); });
         task->worker.detach();
     }
@@ -724,6 +2701,13 @@ __declspec(dllexport) int llm_start(int query_id)
 
 _declspec(dllexport) int llm_stop(int query_id)
 {
+    if (g_remote)
+    {
+        int ret = remote_call(LLM_OP_STOP, TASK_ERROR, { query_id });
+        remote_release_stream(query_id, true);
+        return ret;
+    }
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
     Log("\tStopping task %i!", query_id);
@@ -737,16 +2721,33 @@ _declspec(dllexport) int llm_stop(int query_id)
 
     LLMTask* task  = it->second.get();
     task->interrupt = true;
+    if (task->session)
+    {
+        task->session_cv.notify_all();
+    }
+    else if (task->status == TASK_QUEUED)
+    {
+        // No thread to notice, so it's done already
+        task->status = TASK_INTERRUPT;
+    }
 
     Log("\tStopping thread!");
 
     return TASK_INTERRUPT;
 }
 
-__declspec(dllexport) int llm_get_answer(int query_id, char * buffer, int    buffer_size, int *  out_generated_tokens, int *  out_max_tokens)
+__declspec(dllexport) int llm_get_answer_ex(int query_id, char * buffer, int buffer_size, int * out_generated_tokens, int * out_max_tokens, int * out_flags)
 {
+    if (g_remote)
+    {
+        return remote_get_answer(query_id, buffer, buffer_size, out_generated_tokens, out_max_tokens, out_flags);
+    }
+
     std::lock_guard<std::mutex> lock(g_taskMutex);
 
+    // Polled all the time, so a good place to let expired contexts go
+    evict_retained_locked(false);
+
 #ifdef LOG_ANSWER
     Log("\tGet answer for task %i...", query_id);
 #endif
@@ -764,15 +2765,7 @@ __declspec(dllexport) int llm_get_answer(int query_id, char * buffer, int    buf
 #ifdef LOG_ANSWER
     Log("\tGenerating output...");
 #endif
-    if ((buffer) && (buffer_size > 0))
-    {
-        int len = (int) task->result.size();
-        if (len >= buffer_size) {
-            len = buffer_size - 1;
-        }
-        std::memcpy(buffer, task->result.data(), len);
-        buffer[len] = '\0';
-    }
+    copy_answer(task->result, buffer, buffer_size);
 
     if (out_generated_tokens)
     {
@@ -784,25 +2777,303 @@ __declspec(dllexport) int llm_get_answer(int query_id, char * buffer, int    buf
         *out_max_tokens = task->max_tokens;
     }
 
+    if (out_flags)
+    {
+        *out_flags = task->flags;
+    }
+
     LLMTaskStatus status = task->status;
 
     // If finished or errored, remove task after copying
     if ((status == TASK_FINISHED) || (status == TASK_ERROR) || (status == TASK_INTERRUPT))
     {
-        task->clear();
+        release_task(it);
+    }
 
-        g_tasks.erase(it);
+    return (int) status;
+}
+
+// Like llm_get_answer_ex, but only copies the answer from byte offset on (not NUL terminated), for
+// callers that already have the start of it; out_length is the length of the whole answer.
+// Errors replace the text, so for those it's copied from the start and out_offset is 0.
+// A finished task is only released once the rest of its answer fits in the buffer.
+__declspec(dllexport) int llm_get_answer_from(int query_id, int offset, char * buffer, int buffer_size, int * out_offset, int * out_length,
+                                              int * out_generated_tokens, int * out_max_tokens, int * out_flags)
+{
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    evict_retained_locked(false);
+
+    if (out_offset) *out_offset = 0;
+    if (out_length) *out_length = 0;
+
+    auto it = g_tasks.find(query_id);
+    if (it == g_tasks.end())
+    {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask *     task   = it->second.get();
+    LLMTaskStatus status = task->status;
+    int           length = (int) task->result.size();
+
+    if ((status == TASK_ERROR) || (offset < 0) || (offset > length))
+    {
+        offset = 0;
+    }
+
+    int count = std::min(length - offset, std::max(0, buffer_size));
+    if ((buffer) && (count > 0))
+    {
+        std::memcpy(buffer, task->result.data() + offset, count);
+    }
+
+    if (out_offset) *out_offset = offset;
+    if (out_length) *out_length = length;
+    if (out_generated_tokens) *out_generated_tokens = task->generated_tokens;
+    if (out_max_tokens) *out_max_tokens = task->max_tokens;
+    if (out_flags) *out_flags = task->flags;
 
-        Log("\tTask complete!");
+    if (((status == TASK_FINISHED) || (status == TASK_ERROR) || (status == TASK_INTERRUPT)) && (offset + count == length))
+    {
+        release_task(it);
     }
 
     return (int) status;
 }
 
+__declspec(dllexport) int llm_get_answer(int query_id, char * buffer, int    buffer_size, int *  out_generated_tokens, int *  out_max_tokens)
+{
+    return llm_get_answer_ex(query_id, buffer, buffer_size, out_generated_tokens, out_max_tokens, nullptr);
+}
+
+// Opens a session, whose prompt starts with prefix. The prompt is prefilled in the background as it
+// grows, and the returned id is used with llm_get_answer/llm_stop like a normal query.
+// adapter_id selects a LoRA adapter like llm_set_adapter (0 = none).
+__declspec(dllexport) int llm_session_begin_ex(const char * prefix, int adapter_id, float adapter_scale)
+{
+    if ((g_remote) && (prefix))
+    {
+        return remote_create_task(LLM_OP_SESSION_BEGIN, { adapter_id }, prefix, { adapter_scale });
+    }
+
+    if (!prefix)
+    {
+        Log("Session failed, no prefix provided!");
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    evict_retained_locked(false);
+
+    int id = g_nextId++;
+
+    auto task              = std::make_unique<LLMTask>();
+    task->id               = id;
+    task->prompt           = prefix;
+    task->session          = true;
+    task->session_pending.push_back(prefix);
+    task->status           = TASK_QUEUED;
+    task->generated_tokens = 0;
+    task->adapter_id       = adapter_id;
+    task->adapter_scale    = adapter_scale;
+
+    LLMTask * raw = task.get();
+
+    g_tasks[id] = std::move(task);
+
+    Log("Session %i created!", id);
+
+    g_sessionWorkers++;
+    raw->worker = std::thread([raw]() { run_session(raw); });
+    raw->worker.detach();
+
+    return id;
+}
+
+__declspec(dllexport) int llm_session_begin(const char * prefix)
+{
+    return llm_session_begin_ex(prefix, 0, 1.0f);
+}
+
+__declspec(dllexport) int llm_session_append(int session_id, const char * text)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SESSION_APPEND, TASK_ERROR, { session_id }, {}, (text) ? (text) : (""));
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(session_id);
+    if ((it == g_tasks.end()) || (!it->second->session))
+    {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if ((task->status == TASK_QUEUED) && (!task->session_generate) && (text))
+    {
+        task->prompt          += text;
+        task->session_pending.push_back(text);
+        task->session_cv.notify_all();
+    }
+
+    return task->status;
+}
+
+// Appends the final part of the prompt and starts generating; poll with llm_get_answer
+__declspec(dllexport) int llm_session_generate(int session_id, const char * suffix, int max_tokens)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_SESSION_GENERATE, TASK_ERROR, { session_id, max_tokens }, {}, (suffix) ? (suffix) : (""));
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(session_id);
+    if ((it == g_tasks.end()) || (!it->second->session))
+    {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task = it->second.get();
+    if ((task->status == TASK_QUEUED) && (!task->session_generate))
+    {
+        if (suffix)
+        {
+            task->prompt          += suffix;
+            task->session_pending.push_back(suffix);
+        }
+        task->max_tokens       = max_tokens;
+        task->session_generate = true;
+        task->session_cv.notify_all();
+    }
+
+    return TASK_RUNNING;
+}
+
+// Drops a session that won't be used (e.g. the game was restarted before the end)
+__declspec(dllexport) int llm_session_end(int session_id)
+{
+    if (g_remote)
+    {
+        int ret = remote_call(LLM_OP_SESSION_END, TASK_ERROR, { session_id });
+        remote_release_stream(session_id, false);
+        return ret;
+    }
+
+    std::lock_guard<std::mutex> lock(g_taskMutex);
+
+    auto it = g_tasks.find(session_id);
+    if ((it == g_tasks.end()) || (!it->second->session))
+    {
+        return TASK_INVALID_ID;
+    }
+
+    LLMTask * task  = it->second.get();
+    task->interrupt = true;
+    if ((task->status == TASK_QUEUED) && (!task->session_generate))
+    {
+        // Worker is still prefilling, it removes the task itself
+        task->session_discard = true;
+    }
+    task->session_cv.notify_all();
+
+    return TASK_INTERRUPT;
+}
+
+__declspec(dllexport) void llm_cache_enable(bool enable)
+{
+    if (g_remote)
+    {
+        remote_call(LLM_OP_CACHE_ENABLE, 0, { enable });
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    Log("Response cache %s", enable ? "enabled" : "disabled");
+
+    g_cacheEnabled = enable;
+}
+
+// Enables the cache and backs it with a file, loading any answers already stored there
+__declspec(dllexport) int llm_cache_open(const char * path)
+{
+    if (g_remote)
+    {
+        return remote_call(LLM_OP_CACHE_OPEN, LLM_INIT_ERROR, {}, {}, path);
+    }
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    if ((path == nullptr) || (path[0] == '\0'))
+    {
+        return LLM_INIT_ERROR;
+    }
+
+    Log("Opening response cache %s...", path);
+
+    if (!cache_load_file(path))
+    {
+        Log("\tFailed to open cache file!");
+        return LLM_INIT_ERROR;
+    }
+
+    g_cachePath    = path;
+    g_cacheEnabled = true;
+
+    return LLM_INIT_OK;
+}
+
+__declspec(dllexport) void llm_cache_clear()
+{
+    if (g_remote)
+    {
+        remote_call(LLM_OP_CACHE_CLEAR, 0);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    g_cache.clear();
+
+    // Otherwise the next llm_cache_open would bring everything back
+    if ((!g_cachePath.empty()) && (!cache_create_file(g_cachePath)))
+    {
+        Log("\tCan't truncate cache file %s!", g_cachePath.c_str());
+    }
+}
+
 __declspec(dllexport) void llm_shutdown()
 {
+    // With a host, the model stays loaded there
+    if (g_remote)
+    {
+        remote_disconnect();
+        return;
+    }
+
     Log("\tShutting down LLM...");
 
+    // Session workers wait on their task, so wake them up and let them leave before deleting anything
+    {
+        std::lock_guard<std::mutex> lock(g_taskMutex);
+
+        for (auto & kv : g_tasks)
+        {
+            kv.second->interrupt = true;
+            kv.second->session_cv.notify_all();
+        }
+    }
+    for (int i = 0; (i < 200) && (g_sessionWorkers > 0); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
     {
         std::lock_guard<std::mutex> lock(g_taskMutex);
 
@@ -811,17 +3082,110 @@ __declspec(dllexport) void llm_shutdown()
             kv.second->clear();
         }
         g_tasks.clear();
+
+        for (auto & kv : g_retained)
+        {
+            kv.second->clear();
+        }
+        g_retained.clear();
+        g_specStats.clear();
     }
 
     // Free llama resources
     std::lock_guard<std::mutex> lock(g_llmMutex);
 
+    for (auto & kv : g_adapters)
+    {
+        llama_adapter_lora_free(kv.second.adapter);
+    }
+    g_adapters.clear();
+
     if (g_model) {
         llama_model_free(g_model);  // note: newer API name
         g_model = nullptr;
     }
+    g_modelId.clear();
+    g_pieceArena.clear();
+    g_pieceOffsets.clear();
 
     llama_backend_free();
 }
 
+// Forwards all further calls to llm_host listening on pipe_name (LLM_IPC_DEFAULT_PIPE if empty).
+// If it isn't running and host_path is given, it's started first. Call before llm_init.
+__declspec(dllexport) int llm_connect_host(const char * pipe_name, const char * host_path)
+{
+    if (g_remote)
+    {
+        return LLM_INIT_OK;
+    }
+
+    std::string pipe_path = std::string("\\\\.\\pipe\\") + (((pipe_name) && (pipe_name[0] != '\0')) ? (pipe_name) : (LLM_IPC_DEFAULT_PIPE));
+
+    Log("Connecting to host %s...", pipe_path.c_str());
+
+    HANDLE pipe = open_host_pipe(pipe_path, host_path);
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        Log("\tFailed to connect to host!");
+        return LLM_INIT_ERROR;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_remotePipeMutex);
+        g_remotePipe = pipe;
+    }
+
+    LLMIpcResponse response;
+    std::string    mapping_name;
+    if ((!remote_request(LLM_OP_HELLO, { (int) LLM_IPC_VERSION }, {}, nullptr, response, &mapping_name)) ||
+        (response.ret != (int) LLM_IPC_VERSION))
+    {
+        Log("\tHost version mismatch!");
+
+        std::lock_guard<std::mutex> lock(g_remotePipeMutex);
+        CloseHandle(g_remotePipe);
+        g_remotePipe = INVALID_HANDLE_VALUE;
+        return LLM_INIT_ERROR;
+    }
+
+    g_remoteMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mapping_name.c_str());
+    if (g_remoteMapping)
+    {
+        g_remoteShared = (LLMIpcShared *) MapViewOfFile(g_remoteMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LLMIpcShared));
+    }
+    if ((!g_remoteShared) || (g_remoteShared->version != LLM_IPC_VERSION))
+    {
+        Log("\tFailed to map shared memory %s!", mapping_name.c_str());
+
+        if (g_remoteShared)
+        {
+            UnmapViewOfFile(g_remoteShared);
+            g_remoteShared = nullptr;
+        }
+        if (g_remoteMapping)
+        {
+            CloseHandle(g_remoteMapping);
+            g_remoteMapping = nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(g_remotePipeMutex);
+        CloseHandle(g_remotePipe);
+        g_remotePipe = INVALID_HANDLE_VALUE;
+        return LLM_INIT_ERROR;
+    }
+
+    g_remote = true;
+
+    Log("\tConnected!");
+
+    return LLM_INIT_OK;
+}
+
+// Goes back to running in process; the host keeps the model loaded for the next connection
+__declspec(dllexport) void llm_disconnect_host()
+{
+    remote_disconnect();
+}
+
 }  // extern "C"